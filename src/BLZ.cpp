@@ -0,0 +1,104 @@
+#include "BLZ.hpp"
+#include <cstring>
+
+
+namespace {
+
+//Each flag byte covers 8 tokens, a match is 2 bytes for up to 18 bytes of output
+constexpr size_t MAX_EXPANSION = 9;
+
+auto readU32(const u8 *data) -> u32 {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (u32(data[3]) << 24);
+}
+
+} //namespace
+
+auto decompressedSizeBLZ(size_t size, const u8 (&footer)[8]) -> Result<size_t> {
+    if(size < 8) {
+        return Error{"BLZ data is smaller than its footer!"};
+    }
+
+    const u32 bounds = readU32(footer);
+    const u32 extra_size = readU32(footer + 4);
+    const size_t footer_size = bounds >> 24;
+    const size_t compressed_size = bounds & 0xFFFFFF;
+
+    //The footer is the only thing that decides how much is allocated, so it is checked against
+    //the most a compressed stream of this size could decompress to
+    if(footer_size < 8 || footer_size > compressed_size || compressed_size > size) {
+        return Error::format("BLZ footer is invalid! (Compressed size: 0x%zX, footer size: 0x%zX)", compressed_size, footer_size);
+    }
+
+    if(extra_size > (compressed_size - footer_size) * MAX_EXPANSION) {
+        return Error::format("BLZ footer is invalid! (0x%zX compressed bytes can't grow by 0x%X)", compressed_size - footer_size, extra_size);
+    }
+
+    return size + extra_size;
+}
+
+auto decompressBLZ(std::vector<u8> &data) -> Result<void> {
+    u8 footer[8] = {};
+    if(data.size() >= 8) {
+        std::memcpy(footer, data.data() + data.size() - 8, sizeof(footer));
+    }
+
+    const Result<size_t> decompressed_size = decompressedSizeBLZ(data.size(), footer);
+    if(!decompressed_size) {
+        return decompressed_size.error();
+    }
+
+    const size_t size = data.size();
+    const u32 bounds = readU32(footer);
+    const size_t footer_size = bounds >> 24;
+    const size_t compressed_size = bounds & 0xFFFFFF;
+
+    data.resize(decompressed_size.value());
+    u8 *const buffer = data.data();
+    const size_t total = data.size();
+    const size_t stop = size - compressed_size;
+    size_t in = size - footer_size;
+    size_t out = total;
+
+    //The output never gets behind the input: a literal moves both back by one, and a match is
+    //checked once for the whole of it rather than per byte, both that it only reads output that
+    //has been written and that it doesn't overwrite input that hasn't been read
+    while(in > stop) {
+        u8 flags = buffer[--in];
+
+        for(int token = 0; token < 8 && in > stop; token++, flags <<= 1) {
+            if(!(flags & 0x80)) {
+                buffer[--out] = buffer[--in];
+                continue;
+            }
+
+            if(in - stop < 2) {
+                return Error{"BLZ match runs past the start of the compressed data!"};
+            }
+
+            in -= 2;
+            const u32 match = buffer[in] | (buffer[in + 1] << 8);
+            const size_t length = (match >> 12) + 3;
+            const size_t distance = (match & 0xFFF) + 3;
+
+            if(out - in < length || distance > total - out) {
+                return Error::format("BLZ match at 0x%zX is out of bounds!", in);
+            }
+
+            out -= length;
+            if(distance >= length) {
+                std::memcpy(buffer + out, buffer + out + distance, length);
+            } else {
+                //Overlapping, each byte copies one that was just written
+                for(size_t i = length; i-- > 0;) {
+                    buffer[out + i] = buffer[out + i + distance];
+                }
+            }
+        }
+    }
+
+    if(out != stop) {
+        return Error::format("BLZ data decompressed to 0x%zX bytes less than its footer says!", out - stop);
+    }
+
+    return {};
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Types.hpp"
+#include "Result.hpp"
+#include <vector>
+
+
+//BLZ, the backward LZ77 that the .code of most titles is compressed with, see isCodeCompressed().
+//The data is decoded from its end towards its start, the footer in the last 8 bytes gives
+//how much of the end is compressed and how much larger it gets. Anything before the
+//compressed part is stored as is.
+//
+//Decompresses in place, growing data to the decompressed size. The output overwrites the
+//compressed data behind it, so nothing else is allocated. The footer and every match are
+//checked before they are used, a bad stream gives an Error and leaves data unspecified.
+auto decompressBLZ(std::vector<u8> &data) -> Result<void>;
+//The size decompressBLZ() grows a stream of size bytes to, from its last 8 bytes. Checks the
+//footer the same way, so it can be used to decide whether to decompress before reading the rest.
+auto decompressedSizeBLZ(size_t size, const u8 (&footer)[8]) -> Result<size_t>;
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "BufferPool.hpp"
+#include <algorithm>
+#include <utility>
+
+
+BufferPool::Buffer::Buffer(BufferPool *pool, u8 *memory) : pool(pool), memory(memory) {}
+
+BufferPool::Buffer::~Buffer() {
+    reset();
+}
+
+BufferPool::Buffer::Buffer(Buffer &&other) noexcept {
+    *this = std::move(other);
+}
+
+auto BufferPool::Buffer::operator=(Buffer &&other) noexcept -> Buffer& {
+    if(this != &other) {
+        reset();
+        pool = std::exchange(other.pool, nullptr);
+        memory = std::exchange(other.memory, nullptr);
+    }
+
+    return *this;
+}
+
+auto BufferPool::Buffer::data() const -> u8* {
+    return memory;
+}
+
+auto BufferPool::Buffer::size() const -> size_t {
+    return pool != nullptr ? pool->buffer_size : 0;
+}
+
+BufferPool::Buffer::operator bool() const {
+    return memory != nullptr;
+}
+
+void BufferPool::Buffer::reset() {
+    if(pool != nullptr) {
+        pool->giveBack(memory);
+    }
+
+    pool = nullptr;
+    memory = nullptr;
+}
+
+BufferPool::BufferPool(size_t buffer_size, size_t count) : buffer_size(buffer_size) {
+    count = std::max<size_t>(count, 1);
+    storage.resize(buffer_size * count);
+
+    for(size_t i = 0; i < count; i++) {
+        free_buffers.push_back(storage.data() + i * buffer_size);
+    }
+}
+
+auto BufferPool::bufferSize() const -> size_t {
+    return buffer_size;
+}
+
+auto BufferPool::acquire() -> Buffer {
+    std::unique_lock lock(mutex);
+    available.wait(lock, [this] { return !free_buffers.empty(); });
+
+    u8 *memory = free_buffers.back();
+    free_buffers.pop_back();
+    return Buffer(this, memory);
+}
+
+auto BufferPool::tryAcquire() -> Buffer {
+    std::lock_guard lock(mutex);
+    if(free_buffers.empty()) {
+        return Buffer();
+    }
+
+    u8 *memory = free_buffers.back();
+    free_buffers.pop_back();
+    return Buffer(this, memory);
+}
+
+void BufferPool::giveBack(u8 *memory) {
+    {
+        std::lock_guard lock(mutex);
+        free_buffers.push_back(memory);
+    }
+
+    available.notify_one();
+}
\ No newline at end of file
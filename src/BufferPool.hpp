@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Types.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+
+//A fixed set of equally sized buffers shared between threads, allocated once.
+//Whoever needs a buffer waits until one is handed back, so the memory used
+//for file data never grows past the pool however big the image is.
+class BufferPool {
+public:
+
+    //Goes back to the pool when destroyed
+    class Buffer {
+    public:
+
+        Buffer() = default;
+        ~Buffer();
+        Buffer(const Buffer&) = delete;
+        Buffer(Buffer &&other) noexcept;
+        auto operator=(const Buffer&) -> Buffer& = delete;
+        auto operator=(Buffer &&other) noexcept -> Buffer&;
+
+        auto data() const -> u8*;
+        auto size() const -> size_t;
+        explicit operator bool() const;
+
+    private:
+
+        friend class BufferPool;
+
+        Buffer(BufferPool *pool, u8 *memory);
+        void reset();
+
+        BufferPool *pool = nullptr;
+        u8 *memory = nullptr;
+    };
+
+    BufferPool(size_t buffer_size, size_t count);
+    BufferPool(const BufferPool&) = delete;
+    auto operator=(const BufferPool&) -> BufferPool& = delete;
+
+    auto bufferSize() const -> size_t;
+    //Blocks until a buffer is free
+    auto acquire() -> Buffer;
+    //An empty buffer if none is free
+    auto tryAcquire() -> Buffer;
+
+private:
+
+    void giveBack(u8 *memory);
+
+    size_t buffer_size;
+    std::vector<u8> storage;
+    std::vector<u8*> free_buffers;
+    std::mutex mutex;
+    std::condition_variable available;
+};
\ No newline at end of file
@@ -0,0 +1,374 @@
+#include "Crypto.hpp"
+#include <cstring>
+#include <fstream>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #define AES_X86
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+
+namespace {
+
+constexpr u8 SBOX[256] = {
+    0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+    0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+    0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+    0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+    0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+    0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+    0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+    0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+    0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+    0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+    0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+    0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+    0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+    0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+    0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+    0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+
+constexpr u8 RCON[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+//SubBytes and MixColumns of one byte combined, the other three columns are rotations of it
+struct TTable {
+    u32 values[256];
+
+    constexpr TTable() : values() {
+        for(int i = 0; i < 256; i++) {
+            const u32 s = SBOX[i];
+            const u32 s2 = ((s << 1) ^ (s & 0x80 ? 0x1B : 0)) & 0xFF;
+            values[i] = (s2 << 24) | (s << 16) | (s << 8) | (s2 ^ s);
+        }
+    }
+};
+
+constexpr TTable TE;
+
+auto loadBE32(const u8 *data) -> u32 {
+    return (static_cast<u32>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+void storeBE32(u8 *data, u32 value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+auto rotr(u32 value, int count) -> u32 {
+    return (value >> count) | (value << (32 - count));
+}
+
+auto subWord(u32 word) -> u32 {
+    return (SBOX[word >> 24] << 24) | (SBOX[(word >> 16) & 0xFF] << 16) | (SBOX[(word >> 8) & 0xFF] << 8) | SBOX[word & 0xFF];
+}
+
+void encryptBlockPortable(const u8 round_keys[176], const u8 in[16], u8 out[16]) {
+    u32 s[4], t[4];
+    for(int i = 0; i < 4; i++) {
+        s[i] = loadBE32(in + i * 4) ^ loadBE32(round_keys + i * 4);
+    }
+
+    for(int round = 1; round < 10; round++) {
+        for(int i = 0; i < 4; i++) {
+            t[i] = TE.values[s[i] >> 24] ^ rotr(TE.values[(s[(i + 1) % 4] >> 16) & 0xFF], 8)
+                 ^ rotr(TE.values[(s[(i + 2) % 4] >> 8) & 0xFF], 16) ^ rotr(TE.values[s[(i + 3) % 4] & 0xFF], 24)
+                 ^ loadBE32(round_keys + round * 16 + i * 4);
+        }
+        std::memcpy(s, t, sizeof(s));
+    }
+
+    //The last round has no MixColumns
+    for(int i = 0; i < 4; i++) {
+        const u32 word = (SBOX[s[i] >> 24] << 24) | (SBOX[(s[(i + 1) % 4] >> 16) & 0xFF] << 16)
+                       | (SBOX[(s[(i + 2) % 4] >> 8) & 0xFF] << 8) | SBOX[s[(i + 3) % 4] & 0xFF];
+        storeBE32(out + i * 4, word ^ loadBE32(round_keys + 160 + i * 4));
+    }
+}
+
+//The counter as two halves in native byte order, so it can be incremented cheaply
+struct Counter {
+    u64 high;
+    u64 low;
+
+    void add(u64 value) {
+        low += value;
+        high += low < value;
+    }
+
+    void store(u8 out[16]) const {
+        for(int i = 0; i < 8; i++) {
+            out[i] = high >> (56 - i * 8);
+            out[i + 8] = low >> (56 - i * 8);
+        }
+    }
+};
+
+using CTRFunc = void (*)(const u8 round_keys[176], Counter &counter, u8 *data, size_t blocks);
+
+void ctrPortable(const u8 round_keys[176], Counter &counter, u8 *data, size_t blocks) {
+    u8 block[16], keystream[16];
+
+    for(size_t i = 0; i < blocks; i++) {
+        counter.store(block);
+        counter.add(1);
+        encryptBlockPortable(round_keys, block, keystream);
+
+        for(int j = 0; j < 16; j++) {
+            data[i * 16 + j] ^= keystream[j];
+        }
+    }
+}
+
+#ifdef AES_X86
+
+__attribute__((target("aes,sse2")))
+auto counterBlock(const Counter &counter) -> __m128i {
+    return _mm_set_epi64x(static_cast<long long>(__builtin_bswap64(counter.low)), static_cast<long long>(__builtin_bswap64(counter.high)));
+}
+
+//Eight blocks are kept in flight so the aesenc latency is hidden behind the other blocks
+__attribute__((target("aes,sse2")))
+void ctrAesNi(const u8 round_keys[176], Counter &counter, u8 *data, size_t blocks) {
+    __m128i keys[11];
+    for(int i = 0; i < 11; i++) {
+        keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys + i * 16));
+    }
+
+    while(blocks >= 8) {
+        __m128i b[8];
+        for(int i = 0; i < 8; i++) {
+            b[i] = _mm_xor_si128(counterBlock(counter), keys[0]);
+            counter.add(1);
+        }
+
+        for(int round = 1; round < 10; round++) {
+            for(int i = 0; i < 8; i++) {
+                b[i] = _mm_aesenc_si128(b[i], keys[round]);
+            }
+        }
+
+        for(int i = 0; i < 8; i++) {
+            b[i] = _mm_aesenclast_si128(b[i], keys[10]);
+            __m128i *block = reinterpret_cast<__m128i*>(data + i * 16);
+            _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), b[i]));
+        }
+
+        data += 128;
+        blocks -= 8;
+    }
+
+    while(blocks-- > 0) {
+        __m128i b = _mm_xor_si128(counterBlock(counter), keys[0]);
+        counter.add(1);
+
+        for(int round = 1; round < 10; round++) {
+            b = _mm_aesenc_si128(b, keys[round]);
+        }
+
+        b = _mm_aesenclast_si128(b, keys[10]);
+        __m128i *block = reinterpret_cast<__m128i*>(data);
+        _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), b));
+        data += 16;
+    }
+}
+
+auto cpuHasAesNi() -> bool {
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    return (ecx & (1 << 25)) != 0;
+}
+
+#else
+
+auto cpuHasAesNi() -> bool {
+    return false;
+}
+
+#endif
+
+auto selectCTR() -> CTRFunc {
+#ifdef AES_X86
+    if(cpuHasAesNi()) {
+        return ctrAesNi;
+    }
+#endif
+
+    return ctrPortable;
+}
+
+const CTRFunc ctr_blocks = selectCTR();
+
+auto parseHexKey(const std::string &hex) -> std::optional<AESKey> {
+    if(hex.size() != 32) {
+        return {};
+    }
+
+    AESKey key;
+    for(size_t i = 0; i < key.size(); i++) {
+        try {
+            size_t end = 0;
+            key[i] = static_cast<u8>(std::stoul(hex.substr(i * 2, 2), &end, 16));
+            if(end != 2) {
+                return {};
+            }
+        } catch(const std::exception &e) {
+            return {};
+        }
+    }
+
+    return key;
+}
+
+auto trim(const std::string &str) -> std::string {
+    const size_t start = str.find_first_not_of(" \t\r");
+    const size_t end = str.find_last_not_of(" \t\r");
+    return start == std::string::npos ? std::string() : str.substr(start, end - start + 1);
+}
+
+//128-bit big-endian values as two halves
+struct U128 {
+    u64 high;
+    u64 low;
+};
+
+auto toU128(const AESKey &key) -> U128 {
+    U128 value{0, 0};
+    for(int i = 0; i < 8; i++) {
+        value.high = (value.high << 8) | key[i];
+        value.low = (value.low << 8) | key[i + 8];
+    }
+
+    return value;
+}
+
+auto rotl128(U128 value, int count) -> U128 {
+    if(count >= 64) {
+        value = U128{value.low, value.high};
+        count -= 64;
+    }
+
+    if(count == 0) {
+        return value;
+    }
+
+    return U128{(value.high << count) | (value.low >> (64 - count)), (value.low << count) | (value.high >> (64 - count))};
+}
+
+} //namespace
+
+AESCTR::AESCTR(const AESKey &key) {
+    std::memcpy(round_keys, key.data(), key.size());
+
+    for(int i = 4; i < 44; i++) {
+        u32 word = loadBE32(round_keys + (i - 1) * 4);
+
+        if(i % 4 == 0) {
+            word = subWord((word << 8) | (word >> 24)) ^ (static_cast<u32>(RCON[i / 4 - 1]) << 24);
+        }
+
+        storeBE32(round_keys + i * 4, word ^ loadBE32(round_keys + (i - 4) * 4));
+    }
+}
+
+void AESCTR::crypt(const AESCounter &counter, u64 offset, u8 *data, size_t size) const {
+    Counter current{0, 0};
+    for(int i = 0; i < 8; i++) {
+        current.high = (current.high << 8) | counter[i];
+        current.low = (current.low << 8) | counter[i + 8];
+    }
+    current.add(offset / 16);
+
+    //Partial blocks at either end go through a block of keystream
+    auto partial = [&](size_t skip, size_t count) {
+        u8 keystream[16] = {0};
+        ctr_blocks(round_keys, current, keystream, 1);
+
+        for(size_t i = 0; i < count; i++) {
+            data[i] ^= keystream[skip + i];
+        }
+
+        data += count;
+        size -= count;
+    };
+
+    const size_t skip = offset % 16;
+    if(skip != 0 && size > 0) {
+        partial(skip, std::min<size_t>(16 - skip, size));
+    }
+
+    ctr_blocks(round_keys, current, data, size / 16);
+    data += size / 16 * 16;
+    size %= 16;
+
+    if(size > 0) {
+        partial(0, size);
+    }
+}
+
+auto loadKeyFile(const std::string &path, std::vector<std::string> &warnings) -> std::optional<KeyFile> {
+    std::ifstream file_stream(path);
+    if(!file_stream.is_open()) {
+        return {};
+    }
+
+    KeyFile keys;
+    std::string line;
+    while(std::getline(file_stream, line)) {
+        line = trim(line.substr(0, line.find('#')));
+
+        const size_t equals = line.find('=');
+        if(equals == std::string::npos) {
+            continue;
+        }
+
+        const std::string name = trim(line.substr(0, equals));
+        const std::optional<AESKey> key = parseHexKey(trim(line.substr(equals + 1)));
+        if(!key.has_value()) {
+            warnings.push_back("Invalid key '" + name + "' in key file");
+            continue;
+        }
+
+        //Anything other than the KeyX slots and the generator isn't needed
+        if(name == "generator") {
+            keys.generator = key;
+        } else if(name.size() == 12 && name.compare(0, 6, "slot0x") == 0 && name.compare(8, 4, "KeyX") == 0) {
+            try {
+                const unsigned long slot = std::stoul(name.substr(6, 2), nullptr, 16);
+                if(slot < 0x40) {
+                    keys.key_x[slot] = key;
+                }
+            } catch(const std::exception &e) {
+                warnings.push_back("Invalid key slot '" + name + "' in key file");
+            }
+        }
+    }
+
+    return keys;
+}
+
+auto scrambleKey(const AESKey &key_x, const AESKey &key_y, const AESKey &generator) -> AESKey {
+    const U128 x = rotl128(toU128(key_x), 2);
+    const U128 y = toU128(key_y);
+    const U128 c = toU128(generator);
+
+    U128 value{x.high ^ y.high, x.low ^ y.low};
+    const u64 low = value.low + c.low;
+    value.high += c.high + (low < c.low);
+    value.low = low;
+    value = rotl128(value, 87);
+
+    AESKey key;
+    for(int i = 0; i < 8; i++) {
+        key[i] = value.high >> (56 - i * 8);
+        key[i + 8] = value.low >> (56 - i * 8);
+    }
+
+    return key;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Types.hpp"
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+using AESKey = std::array<u8, 16>;
+using AESCounter = std::array<u8, 16>; //A 128-bit big-endian number
+
+//AES-128 in CTR mode, the same operation both encrypts and decrypts.
+//Uses AES-NI when the CPU has it, otherwise a portable table based implementation.
+class AESCTR {
+public:
+
+    explicit AESCTR(const AESKey &key);
+
+    //XORs the keystream into data, starting offset bytes into the stream that begins at counter.
+    //The offset doesn't have to be a multiple of the block size.
+    void crypt(const AESCounter &counter, u64 offset, u8 *data, size_t size) const;
+
+private:
+
+    u8 round_keys[11 * 16];
+};
+
+//The keys read from a key file, in the same format as the aes_keys.txt used by emulators:
+//lines of 'slot0x2CKeyX=<hex>' and 'generator=<hex>', '#' starts a comment
+struct KeyFile {
+    std::optional<AESKey> key_x[0x40];
+    std::optional<AESKey> generator;
+};
+
+//Lines with a bad key or slot are skipped and described in warnings, for the caller to report
+auto loadKeyFile(const std::string &path, std::vector<std::string> &warnings) -> std::optional<KeyFile>;
+
+//The hardware key scrambler: ((KeyX <<< 2) ^ KeyY) + generator) <<< 87
+auto scrambleKey(const AESKey &key_x, const AESKey &key_y, const AESKey &generator) -> AESKey;
\ No newline at end of file
@@ -0,0 +1,876 @@
+#include "Dump.hpp"
+#include "Uring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+    #include <cerrno>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <sys/sendfile.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#elif defined(_WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+
+namespace {
+
+//Files are written in runs of neighbouring files, each run is one read-ahead hint and one pool task
+constexpr size_t RUN_MAX_FILES = 64;
+constexpr size_t RUN_MAX_BYTES = 4 * 1024 * 1024;
+//Reading through a gap this small is cheaper than a seek, so it doesn't end a run
+constexpr size_t RUN_MAX_GAP = 64 * 1024;
+//Encrypted data is decrypted this much at a time
+constexpr size_t DECRYPT_CHUNK = 1024 * 1024;
+
+//Reads the region a chunk at a time into a buffer, decrypting it if needed. The buffer comes
+//from the pool if there is one, and each chunk is dropped from the mapping once it has been read.
+template<typename Write>
+auto writeBuffered(const Image &image, const Region &region, BufferPool *buffers, Write write) -> bool {
+    thread_local std::vector<u8> local_buffer;
+    BufferPool::Buffer pooled;
+    u8 *buffer = nullptr;
+    size_t buffer_size = 0;
+
+    if(buffers != nullptr) {
+        pooled = buffers->acquire();
+        buffer = pooled.data();
+        buffer_size = pooled.size();
+    } else {
+        local_buffer.resize(DECRYPT_CHUNK);
+        buffer = local_buffer.data();
+        buffer_size = local_buffer.size();
+    }
+
+    for(size_t done = 0; done < region.size;) {
+        const size_t size = std::min(buffer_size, region.size - done);
+        image.read(region.offset + done, buffer, size);
+        image.release(region.offset + done, size);
+
+        if(!write(buffer, size)) {
+            return false;
+        }
+
+        done += size;
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+
+//Once a copy method turns out to be unsupported between the input and output
+//filesystems don't bother trying it again for every file
+std::atomic<bool> copy_file_range_usable = true;
+std::atomic<bool> sendfile_usable = true;
+
+auto isUnsupported(int error) -> bool {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP;
+}
+
+auto writeAll(int out_fd, const u8 *data, size_t size) -> bool {
+    while(size > 0) {
+        const ssize_t written = write(out_fd, data, size);
+
+        if(written < 0 && errno == EINTR) {
+            continue;
+        } else if(written <= 0) {
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+//Copies a region of the image into out_fd without the data passing through
+//user space where possible: copy_file_range (which can share extents on
+//reflink capable filesystems), then sendfile, then a plain write from the mapping.
+//Regions that were decrypted in place are always written from the mapping, or through
+//a buffer when there is a buffer pool.
+auto copyRegion(int out_fd, const Image &image, const Region &region, BufferPool *buffers) -> bool {
+    loff_t in_offset = static_cast<loff_t>(region.offset);
+    size_t remaining = region.size;
+    const bool from_file = image.matchesFile(region);
+
+    while(remaining > 0 && from_file && copy_file_range_usable) {
+        const ssize_t copied = copy_file_range(image.fd(), &in_offset, out_fd, nullptr, remaining, 0);
+
+        if(copied > 0) {
+            remaining -= copied;
+        } else if(copied == 0) {
+            //Unexpected end of the input, let the fallbacks deal with it
+            break;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(isUnsupported(errno) && in_offset == static_cast<loff_t>(region.offset)) {
+            copy_file_range_usable = false;
+        } else {
+            break;
+        }
+    }
+
+    off_t send_offset = static_cast<off_t>(in_offset);
+    while(remaining > 0 && from_file && sendfile_usable) {
+        const ssize_t sent = sendfile(out_fd, image.fd(), &send_offset, remaining);
+
+        if(sent > 0) {
+            remaining -= sent;
+        } else if(sent == 0) {
+            break;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(isUnsupported(errno)) {
+            sendfile_usable = false;
+        } else {
+            break;
+        }
+    }
+
+    const Region rest{region.offset + (region.size - remaining), remaining};
+    if(buffers != nullptr) {
+        return writeBuffered(image, rest, buffers, [out_fd](const u8 *data, size_t size) { return writeAll(out_fd, data, size); });
+    }
+
+    return writeAll(out_fd, image.data() + rest.offset, rest.size);
+}
+
+auto writeRegion(int out_fd, const Image &image, const Region &region, BufferPool *buffers) -> bool {
+    return image.isEncrypted(region)
+        ? writeBuffered(image, region, buffers, [out_fd](const u8 *data, size_t size) { return writeAll(out_fd, data, size); })
+        : copyRegion(out_fd, image, region, buffers);
+}
+
+//Opens a file relative to dir_fd, which can be AT_FDCWD, and writes the region to it
+auto writeRegionAt(int dir_fd, const char *path, const Image &image, const Region &region, BufferPool *buffers) -> bool {
+    const int out_fd = openat(dir_fd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if(out_fd < 0) {
+        return false;
+    }
+
+    const bool success = writeRegion(out_fd, image, region, buffers);
+    return close(out_fd) == 0 && success;
+}
+
+//Directory descriptors cached while writing, past this directories are reached by path from the root
+constexpr u32 OPEN_DIRS_MAX = 256;
+//Descriptors of the directories on the way down held while planning, past this the shallowest are closed
+constexpr size_t PLAN_DIRS_MAX = 64;
+
+#endif
+
+//Tree names are UTF-16, the file system takes UTF-8
+void appendUtf8(std::string &out, std::u16string_view name) {
+    for(size_t i = 0; i < name.size(); i++) {
+        u32 c = name[i];
+        if(c >= 0xD800 && c < 0xDC00 && i + 1 < name.size() && name[i + 1] >= 0xDC00 && name[i + 1] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (name[++i] - 0xDC00);
+        }
+
+        if(c < 0x80) {
+            out += static_cast<char>(c);
+        } else if(c < 0x800) {
+            out += static_cast<char>(0xC0 | c >> 6);
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else if(c < 0x10000) {
+            out += static_cast<char>(0xE0 | c >> 12);
+            out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | c >> 18);
+            out += static_cast<char>(0x80 | (c >> 12 & 0x3F));
+            out += static_cast<char>(0x80 | (c >> 6 & 0x3F));
+            out += static_cast<char>(0x80 | (c & 0x3F));
+        }
+    }
+}
+
+//Relative to the plan's root, only built once per directory or for messages
+auto directoryPath(const DumpPlan &plan, u32 dir) -> std::filesystem::path {
+    std::vector<u32> chain;
+    for(; dir != RomFSTree::NONE; dir = plan.dirs[dir].parent) {
+        chain.push_back(dir);
+    }
+
+    std::filesystem::path path;
+    for(auto it = chain.rbegin(); it != chain.rend(); it++) {
+        path /= plan.dirs[*it].name;
+    }
+
+    return path;
+}
+
+//A directory on the way down from where planning started
+struct PlanFrame {
+    u32 dir; //In the tree
+    u32 index; //In the plan
+    u32 next_child; //In the tree, the next subdirectory to plan
+    int fd; //-1 if it isn't held open
+};
+
+//Walks the tree with a stack of its own, so the depth isn't limited by the call stack. Each directory is made
+//relative to its parent's descriptor. Only the deepest few on the way down are held open, the others are
+//closed and reopened through ".." of their child when the walk comes back up to them.
+//A directory that can't be made is reported and nothing in it is planned.
+void planDirectoryAt(const DumpContext &context, u32 dir, u32 parent, [[maybe_unused]] int parent_fd, DumpPlan &plan) {
+    const RomFSTree &tree = *context.tree;
+    std::vector<PlanFrame> stack;
+
+#ifdef __linux__
+    size_t open_fds = 0;
+
+    //Never the directory at the top of the stack, that is the one being worked in
+    auto closeAncestor = [&stack, &open_fds] {
+        for(size_t i = 0; i + 1 < stack.size(); i++) {
+            if(stack[i].fd >= 0) {
+                close(stack[i].fd);
+                stack[i].fd = -1;
+                open_fds--;
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    //Running out of descriptors is dealt with the same way as reaching the limit
+    auto openDirectory = [&closeAncestor, &open_fds](int at_fd, const char *name) {
+        if(open_fds >= PLAN_DIRS_MAX) {
+            closeAncestor();
+        }
+
+        while(true) {
+            const int fd = openat(at_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            if(fd >= 0) {
+                open_fds++;
+                return fd;
+            } else if((errno != EMFILE && errno != ENFILE) || !closeAncestor()) {
+                return -1;
+            }
+        }
+    };
+#endif
+
+    auto enter = [&](u32 entered, u32 entered_parent, [[maybe_unused]] int at_fd) {
+        const u32 index = static_cast<u32>(plan.dirs.size());
+        plan.dirs.push_back(PlannedDirectory{entered_parent, {}});
+        appendUtf8(plan.dirs.back().name, tree.dirName(entered));
+
+#ifdef __linux__
+        if(mkdirat(at_fd, plan.dirs[index].name.c_str(), 0777) != 0 && errno != EEXIST) {
+            const int error = errno;
+            printf("Error: Failed to create directory '%s' (%s)\n", (plan.root / directoryPath(plan, index)).string().c_str(), std::strerror(error));
+            return;
+        }
+
+        int fd = -1;
+        if(tree.dir_children[entered] != RomFSTree::NONE) {
+            fd = openDirectory(at_fd, plan.dirs[index].name.c_str());
+            if(fd < 0) {
+                const int error = errno;
+                printf("Error: Failed to open directory '%s' (%s), its subdirectories are skipped\n", (plan.root / directoryPath(plan, index)).string().c_str(), std::strerror(error));
+            }
+        }
+
+        stack.push_back(PlanFrame{entered, index, fd >= 0 ? tree.dir_children[entered] : RomFSTree::NONE, fd});
+#else
+        std::error_code error;
+        std::filesystem::create_directory(plan.root / directoryPath(plan, index), error);
+        if(error) {
+            printf("Error: Failed to create directory '%s' (%s)\n", (plan.root / directoryPath(plan, index)).string().c_str(), error.message().c_str());
+            return;
+        }
+
+        stack.push_back(PlanFrame{entered, index, tree.dir_children[entered], -1});
+#endif
+    };
+
+    enter(dir, parent, parent_fd);
+    while(!stack.empty()) {
+        PlanFrame &frame = stack.back();
+        if(frame.next_child != RomFSTree::NONE) {
+            const u32 child = frame.next_child;
+            frame.next_child = tree.dir_siblings[child];
+            enter(child, frame.index, frame.fd);
+            continue;
+        }
+
+        for(u32 file = tree.dir_files[frame.dir]; file != RomFSTree::NONE; file = tree.file_siblings[file]) {
+            planFile(context, file, frame.index, plan);
+        }
+
+#ifdef __linux__
+        //A closed parent is reopened even with no subdirectories left, its own parent may need it to be
+        if(stack.size() > 1 && stack[stack.size() - 2].fd < 0) {
+            PlanFrame &up = stack[stack.size() - 2];
+            up.fd = openDirectory(frame.fd, "..");
+            if(up.fd < 0 && up.next_child != RomFSTree::NONE) {
+                const int error = errno;
+                printf("Error: Failed to reopen directory '%s' (%s), the rest of its subdirectories are skipped\n", (plan.root / directoryPath(plan, up.index)).string().c_str(), std::strerror(error));
+                up.next_child = RomFSTree::NONE;
+            }
+        }
+
+        if(frame.fd >= 0) {
+            close(frame.fd);
+            open_fds--;
+        }
+#endif
+
+        stack.pop_back();
+    }
+}
+
+//Writes the files of a plan, from any number of threads at once. On Linux each directory is opened
+//the first time one of its files is written and closed after its last, so every file is opened
+//with just its own name.
+class PlanWriter {
+public:
+
+    PlanWriter(const DumpContext &context, DumpPlan plan);
+    ~PlanWriter();
+
+    PlanWriter(const PlanWriter&) = delete;
+    auto operator=(const PlanWriter&) -> PlanWriter& = delete;
+
+    auto plan() const -> const DumpPlan&;
+    //Every file goes through either write, or verify and then the caller writes it and releases its directory
+    void write(const PlannedFile &file);
+    auto verify(const PlannedFile &file) -> bool;
+    //Full path, for messages
+    auto path(const PlannedFile &file) const -> std::filesystem::path;
+
+#ifdef __linux__
+    auto rootFd() const -> int;
+    //-1 if the directory can't be held open, it can still be reached from the root by its path
+    auto acquire(u32 dir) -> int;
+    void release(u32 dir);
+#endif
+
+private:
+
+    const DumpContext context;
+    const DumpPlan planned;
+
+#ifdef __linux__
+    int root_fd;
+    std::unique_ptr<std::atomic<int>[]> dir_fds;
+    std::unique_ptr<std::atomic<u32>[]> remaining; //Files of each directory not written yet
+    std::atomic<u32> open_dirs = 0;
+#endif
+};
+
+PlanWriter::PlanWriter(const DumpContext &context, DumpPlan plan) : context(context), planned(std::move(plan)) {
+#ifdef __linux__
+    root_fd = open(planned.root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    dir_fds = std::make_unique<std::atomic<int>[]>(planned.dirs.size());
+    remaining = std::make_unique<std::atomic<u32>[]>(planned.dirs.size());
+
+    for(size_t i = 0; i < planned.dirs.size(); i++) {
+        dir_fds[i] = -1;
+        remaining[i] = 0;
+    }
+
+    for(const auto &file : planned.files) {
+        remaining[file.dir]++;
+    }
+#endif
+}
+
+PlanWriter::~PlanWriter() {
+#ifdef __linux__
+    for(size_t i = 0; i < planned.dirs.size(); i++) {
+        if(dir_fds[i] >= 0) {
+            close(dir_fds[i]);
+        }
+    }
+
+    if(root_fd >= 0) {
+        close(root_fd);
+    }
+#endif
+}
+
+auto PlanWriter::plan() const -> const DumpPlan& {
+    return planned;
+}
+
+auto PlanWriter::path(const PlannedFile &file) const -> std::filesystem::path {
+    std::string name;
+    appendUtf8(name, context.tree->fileName(file.file));
+    return planned.root / directoryPath(planned, file.dir) / name;
+}
+
+auto PlanWriter::verify(const PlannedFile &file) -> bool {
+    if(context.verifier == nullptr || context.verifier->verify(file.region)) {
+        return true;
+    }
+
+    printf("Skipping file '%s', it failed hash verification\n", path(file).string().c_str());
+#ifdef __linux__
+    release(file.dir);
+#endif
+    return false;
+}
+
+void PlanWriter::write(const PlannedFile &file) {
+    if(!verify(file)) {
+        return;
+    }
+
+#ifdef __linux__
+    thread_local std::string name;
+    name.clear();
+    appendUtf8(name, context.tree->fileName(file.file));
+
+    const int dir_fd = acquire(file.dir);
+    const bool success = dir_fd >= 0
+        ? writeRegionAt(dir_fd, name.c_str(), *context.image, file.region, context.buffers)
+        : writeRegionAt(root_fd, (directoryPath(planned, file.dir) / name).c_str(), *context.image, file.region, context.buffers);
+    release(file.dir);
+#else
+    const bool success = dumpRegion(path(file), *context.image, file.region, context.buffers);
+#endif
+
+    if(!success) {
+        printf("Failed to dump file '%s'\n", path(file).string().c_str());
+    } else if(context.dumped_files != nullptr) {
+        (*context.dumped_files)++;
+    }
+}
+
+#ifdef __linux__
+
+auto PlanWriter::rootFd() const -> int {
+    return root_fd;
+}
+
+auto PlanWriter::acquire(u32 dir) -> int {
+    int fd = dir_fds[dir].load(std::memory_order_acquire);
+    if(fd >= 0) {
+        return fd;
+    }
+
+    if(open_dirs.fetch_add(1) >= OPEN_DIRS_MAX) {
+        open_dirs--;
+        return -1;
+    }
+
+    fd = openat(root_fd, directoryPath(planned, dir).c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        open_dirs--;
+        return -1;
+    }
+
+    //Another thread may have opened it meanwhile, keep theirs
+    int expected = -1;
+    if(!dir_fds[dir].compare_exchange_strong(expected, fd, std::memory_order_acq_rel)) {
+        close(fd);
+        open_dirs--;
+        return expected;
+    }
+
+    return fd;
+}
+
+//Whoever releases the last file of a directory is the last one using its descriptor
+void PlanWriter::release(u32 dir) {
+    if(remaining[dir].fetch_sub(1) == 1) {
+        const int fd = dir_fds[dir].exchange(-1);
+        if(fd >= 0) {
+            close(fd);
+            open_dirs--;
+        }
+    }
+}
+
+#endif
+
+//The files of a run are contiguous in the plan, a run only covers the image between its first and last file
+auto runRegion(const std::vector<PlannedFile> &files, size_t first, size_t last) -> Region {
+    size_t end = 0;
+    for(size_t i = first; i < last; i++) {
+        end = std::max(end, files[i].region.offset + files[i].region.size);
+    }
+
+    return Region{files[first].region.offset, end - files[first].region.offset};
+}
+
+void prefetch(const Image &image, const Region &region) {
+    image.advise(region.offset, std::min(region.size, RUN_MAX_BYTES), Image::Access::WillNeed);
+}
+
+#ifdef __linux__
+
+//Files in flight at once with io_uring, each holds a registered file slot from its open to its close
+constexpr unsigned URING_FILES = 128;
+constexpr unsigned URING_ENTRIES = 256;
+//Bigger files are left to copyRegion, which can share extents and doesn't need the data in memory
+constexpr size_t URING_MAX_FILE = 1024 * 1024;
+
+enum UringOp : u64 {
+    URING_OPEN = 0,
+    URING_WRITE = 1,
+    URING_CLOSE = 2
+};
+
+struct UringFile {
+    const PlannedFile *file;
+    std::string name; //Relative to the directory, or to the root if the directory isn't held open
+    std::vector<u8> decrypted;
+    BufferPool::Buffer buffer; //Holds the data instead of the mapping when memory is bounded
+    unsigned pending;
+    bool failed;
+};
+
+//Writes the plan with a linked open, write and close per file, with the file opened
+//straight into a registered slot so its descriptor never has to come back to user space.
+//Returns false if io_uring can't be used, nothing has been written then. If the ring fails
+//part way the files in flight are waited for and the rest are written the normal way,
+//unless they can't be waited for, then the dump fails.
+auto dumpPlanUring(const DumpContext &context, PlanWriter &writer) -> Result<bool> {
+    std::unique_ptr<IoUring> ring = IoUring::create(URING_ENTRIES, URING_FILES);
+    if(ring == nullptr) {
+        return false;
+    }
+
+    //The kernel holds pointers to the names and data of the files in flight, so these
+    //can't be freed (or moved) until all of them have completed
+    std::vector<UringFile> files(URING_FILES);
+    std::vector<unsigned> free_slots;
+    for(unsigned slot = URING_FILES; slot-- > 0;) {
+        free_slots.push_back(slot);
+    }
+
+    unsigned in_flight = 0; //Queued operations that haven't completed
+    auto complete = [&context, &files, &free_slots, &in_flight, &writer](u64 user_data, s32 res) {
+        const unsigned slot = static_cast<unsigned>(user_data >> 2);
+        UringFile &file = files[slot];
+        in_flight--;
+
+        switch(user_data & 3) {
+            case URING_OPEN: writer.release(file.file->dir); file.failed |= res < 0; break;
+            case URING_WRITE: file.failed |= res < 0 || static_cast<size_t>(res) != file.file->region.size; break;
+            case URING_CLOSE: file.failed |= res < 0; break;
+        }
+
+        if(--file.pending == 0) {
+            if(file.failed) {
+                printf("Failed to dump file '%s'\n", writer.path(*file.file).string().c_str());
+            } else if(context.dumped_files != nullptr) {
+                (*context.dumped_files)++;
+            }
+
+            file.decrypted = {};
+            file.buffer = {};
+            free_slots.push_back(slot);
+        }
+    };
+
+    int failure = 0; //errno of the submission that failed, if one did
+    auto waitForSpace = [&](unsigned files_needed, unsigned entries_needed) {
+        while(free_slots.size() < files_needed || ring->sqSpace() < entries_needed) {
+            if(!ring->submit(1)) {
+                failure = errno;
+                return false;
+            }
+            ring->reap(complete);
+        }
+
+        return true;
+    };
+
+    //Buffers can also be held by other threads, only wait on them when none of ours are in flight
+    auto waitForBuffer = [&](BufferPool::Buffer &buffer) {
+        while(!(buffer = context.buffers->tryAcquire())) {
+            if(free_slots.size() == URING_FILES) {
+                buffer = context.buffers->acquire();
+                break;
+            }
+
+            if(!ring->submit(1)) {
+                failure = errno;
+                return false;
+            }
+            ring->reap(complete);
+        }
+
+        return true;
+    };
+
+    const size_t max_file = context.buffers != nullptr ? std::min(URING_MAX_FILE, context.buffers->bufferSize()) : URING_MAX_FILE;
+    const std::vector<PlannedFile> &plan_files = writer.plan().files;
+    Region window{0, 0};
+    size_t next = 0;
+    for(; next < plan_files.size(); next++) {
+        const PlannedFile &planned = plan_files[next];
+        if(planned.region.size > max_file) {
+            writer.write(planned);
+            continue;
+        }
+
+        if(!writer.verify(planned)) {
+            continue;
+        }
+
+        if(planned.region.offset + planned.region.size > window.offset + window.size) {
+            context.image->release(window.offset, window.size);
+            window = Region{planned.region.offset, RUN_MAX_BYTES};
+            prefetch(*context.image, window);
+        }
+
+        BufferPool::Buffer buffer;
+        if(!waitForSpace(1, 3) || (context.buffers != nullptr && planned.region.size > 0 && !waitForBuffer(buffer))) {
+            break;
+        }
+
+        const unsigned slot = free_slots.back();
+        free_slots.pop_back();
+
+        UringFile &file = files[slot];
+        file.file = &planned;
+        file.name.clear();
+        file.buffer = std::move(buffer);
+        file.pending = planned.region.size > 0 ? 3 : 2;
+        file.failed = false;
+        in_flight += file.pending;
+
+        int dir_fd = writer.acquire(planned.dir);
+        if(dir_fd < 0) {
+            dir_fd = writer.rootFd();
+            file.name = directoryPath(writer.plan(), planned.dir).string() + '/';
+        }
+        appendUtf8(file.name, context.tree->fileName(planned.file));
+
+        const u8 *data = context.image->data() + planned.region.offset;
+        if(file.buffer) {
+            context.image->read(planned.region.offset, file.buffer.data(), planned.region.size);
+            context.image->release(planned.region.offset, planned.region.size);
+            data = file.buffer.data();
+        } else if(context.image->isEncrypted(planned.region)) {
+            file.decrypted.resize(planned.region.size);
+            context.image->read(planned.region.offset, file.decrypted.data(), planned.region.size);
+            data = file.decrypted.data();
+        }
+
+        //Hard links keep the close running even if the open or write fails.
+        //The directory is released once the open completes, its name has been resolved by then.
+        io_uring_sqe *open_sqe = ring->getSqe();
+        open_sqe->opcode = IORING_OP_OPENAT;
+        open_sqe->flags = IOSQE_IO_HARDLINK;
+        open_sqe->fd = dir_fd;
+        open_sqe->addr = reinterpret_cast<u64>(file.name.c_str());
+        open_sqe->len = 0644;
+        open_sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        open_sqe->file_index = slot + 1;
+        open_sqe->user_data = (u64(slot) << 2) | URING_OPEN;
+
+        if(planned.region.size > 0) {
+            io_uring_sqe *write_sqe = ring->getSqe();
+            write_sqe->opcode = IORING_OP_WRITE;
+            write_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+            write_sqe->fd = static_cast<s32>(slot);
+            write_sqe->addr = reinterpret_cast<u64>(data);
+            write_sqe->len = static_cast<u32>(planned.region.size);
+            write_sqe->user_data = (u64(slot) << 2) | URING_WRITE;
+        }
+
+        io_uring_sqe *close_sqe = ring->getSqe();
+        close_sqe->opcode = IORING_OP_CLOSE;
+        close_sqe->file_index = slot + 1;
+        close_sqe->user_data = (u64(slot) << 2) | URING_CLOSE;
+    }
+
+    //Every file in flight has to complete before its name and data are freed, so this blocks until
+    //all of them have. The kernel being short of memory or of room for completions passes once
+    //what is ready has been reaped, any other failure means the ring can't be waited on.
+    while(in_flight > 0) {
+        if(!ring->submit(in_flight)) {
+            if(errno != EAGAIN && errno != EBUSY) {
+                const int error = errno;
+                //Closing the ring cancels what is left in it, before the names and data go away
+                ring.reset();
+                context.image->release(window.offset, window.size);
+                return Error::format("io_uring couldn't finish writing the files in flight (%s)", std::strerror(error));
+            }
+            std::this_thread::yield();
+        }
+        ring->reap(complete);
+    }
+
+    context.image->release(window.offset, window.size);
+
+    //The files that never made it into the ring, every buffer is back in the pool by now
+    if(next < plan_files.size()) {
+        printf("Warning: io_uring failed (%s), writing the remaining %zu files the normal way\n", std::strerror(failure), plan_files.size() - next);
+        for(; next < plan_files.size(); next++) {
+            writer.write(plan_files[next]);
+        }
+    }
+
+    return true;
+}
+
+#endif
+
+std::once_flag uring_warning;
+
+} //namespace
+
+auto dumpRegion(const std::filesystem::path &path, const Image &image, const Region &region, BufferPool *buffers) -> bool {
+#ifdef __linux__
+    return writeRegionAt(AT_FDCWD, path.c_str(), image, region, buffers);
+#else
+    std::ofstream file_stream(path, std::ios::binary);
+
+    if(!file_stream.is_open()) {
+        return false;
+    }
+
+    if(image.isEncrypted(region) || buffers != nullptr) {
+        return writeBuffered(image, region, buffers, [&file_stream](const u8 *data, size_t size) {
+            return static_cast<bool>(file_stream.write(reinterpret_cast<const char*>(data), size));
+        });
+    }
+
+    file_stream.write(reinterpret_cast<const char*>(image.data() + region.offset), region.size);
+    return true;
+#endif
+}
+
+auto dumpRegionToStdout(const Image &image, const Region &region, BufferPool *buffers) -> bool {
+    std::fflush(stdout);
+#ifdef __linux__
+    return writeRegion(STDOUT_FILENO, image, region, buffers);
+#else
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    const bool success = writeBuffered(image, region, buffers, [](const u8 *data, size_t size) {
+        return std::fwrite(data, 1, size, stdout) == size;
+    });
+    return std::fflush(stdout) == 0 && success;
+#endif
+}
+
+auto planPath(DumpPlan &plan, const std::filesystem::path &relative) -> u32 {
+    std::filesystem::create_directories(plan.root / relative);
+    plan.dirs.push_back(PlannedDirectory{RomFSTree::NONE, relative.string()});
+    return static_cast<u32>(plan.dirs.size() - 1);
+}
+
+void planFile(const DumpContext &context, u32 file, u32 dir, DumpPlan &plan) {
+    const RomFSTree &tree = *context.tree;
+    const Region region{context.file_data.offset + tree.file_offsets[file], tree.file_sizes[file]};
+    plan.files.push_back(PlannedFile{dir, file, region});
+}
+
+void planDirectory(const DumpContext &context, u32 dir, u32 parent, DumpPlan &plan) {
+#ifdef __linux__
+    const std::filesystem::path parent_path = plan.root / directoryPath(plan, parent);
+    const int parent_fd = open(parent_path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(parent_fd < 0) {
+        const int error = errno;
+        printf("Error: Failed to open directory '%s' (%s)\n", parent_path.string().c_str(), std::strerror(error));
+        return;
+    }
+
+    planDirectoryAt(context, dir, parent, parent_fd, plan);
+    close(parent_fd);
+#else
+    planDirectoryAt(context, dir, parent, -1, plan);
+#endif
+}
+
+auto dumpPlan(const DumpContext &context, DumpPlan plan) -> Result<void> {
+    std::stable_sort(plan.files.begin(), plan.files.end(), [](const PlannedFile &a, const PlannedFile &b) { return a.region.offset < b.region.offset; });
+    auto writer = std::make_shared<PlanWriter>(context, std::move(plan));
+
+    if(context.uring) {
+#ifdef __linux__
+        const Result<bool> written = dumpPlanUring(context, *writer);
+        if(!written) {
+            return written.error();
+        } else if(written.value()) {
+            return {};
+        }
+#endif
+        std::call_once(uring_warning, [] { printf("Warning: io_uring isn't available, the files are written the normal way\n"); });
+    }
+
+    //Runs as [first, last) ranges of the sorted plan
+    const std::vector<PlannedFile> &files = writer->plan().files;
+    std::vector<std::pair<size_t, size_t>> runs;
+    size_t run_start = 0;
+    size_t run_end = 0;
+    for(size_t i = 0; i < files.size(); i++) {
+        const Region &region = files[i].region;
+        const bool full = i - run_start == RUN_MAX_FILES || region.offset + region.size - files[run_start].region.offset > RUN_MAX_BYTES;
+
+        if(i > run_start && (full || region.offset > run_end + RUN_MAX_GAP)) {
+            runs.emplace_back(run_start, i);
+            run_start = i;
+        }
+
+        run_end = i == run_start ? region.offset + region.size : std::max(run_end, region.offset + region.size);
+    }
+    if(run_start < files.size()) {
+        runs.emplace_back(run_start, files.size());
+    }
+
+    if(runs.empty()) {
+        return {};
+    }
+
+    //Each run prefetches the one after it before writing its own files, so reading and writing overlap
+    auto dumpRun = [context, writer](size_t first, size_t last, std::optional<Region> next) {
+        if(next.has_value()) {
+            prefetch(*context.image, next.value());
+        }
+
+        for(size_t i = first; i < last; i++) {
+            writer->write(writer->plan().files[i]);
+        }
+
+        //Files release their own data, this catches the neighbouring pages a fault maps along with it
+        const Region run = runRegion(writer->plan().files, first, last);
+        context.image->release(run.offset, run.size);
+    };
+
+    prefetch(*context.image, runRegion(files, runs[0].first, runs[0].second));
+
+    if(context.pool == nullptr) {
+        for(size_t i = 0; i < runs.size(); i++) {
+            const std::optional<Region> next = i + 1 < runs.size() ? std::optional(runRegion(files, runs[i + 1].first, runs[i + 1].second)) : std::nullopt;
+            dumpRun(runs[i].first, runs[i].second, next);
+        }
+
+        return {};
+    }
+
+    //Queued last run first: workers take the newest task of their own queue first,
+    //so every worker starts at the front of the image and the sweep moves forward
+    for(size_t i = runs.size(); i-- > 0;) {
+        const std::optional<Region> next = i + 1 < runs.size() ? std::optional(runRegion(files, runs[i + 1].first, runs[i + 1].second)) : std::nullopt;
+        context.pool->submit([dumpRun, run = runs[i], next] {
+            dumpRun(run.first, run.second, next);
+        }, *context.group);
+    }
+
+    return {};
+}
\ No newline at end of file
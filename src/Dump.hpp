@@ -0,0 +1,66 @@
+#pragma once
+
+#include "BufferPool.hpp"
+#include "Image.hpp"
+#include "RomFS.hpp"
+#include "ThreadPool.hpp"
+#include "Verify.hpp"
+#include <atomic>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+
+struct DumpContext {
+    const Image *image;
+    const RomFSTree *tree;
+    Region file_data; //The RomFS file data the tree's file offsets are relative to
+    ThreadPool *pool; //If null everything is dumped on the calling thread
+    TaskGroup *group; //Work queued on the pool joins this group
+    BlockVerifier *verifier; //If set, files that fail the IVFC check are not written
+    bool uring; //Write the files with io_uring from the calling thread where the kernel supports it
+    BufferPool *buffers; //If set, file data is only read through these, for a bounded amount of memory
+    std::atomic<size_t> *dumped_files; //If set, counts the files that were written
+};
+
+//A directory of a dump, named relative to its parent
+struct PlannedDirectory {
+    u32 parent; //Index in the plan, RomFSTree::NONE if the name is relative to the plan's root
+    std::string name; //UTF-8, a path of several components for directories placed from the root
+};
+
+//A file of a dump, every file is planned before any of them are written
+struct PlannedFile {
+    u32 dir; //Index in the plan
+    u32 file; //Index in the tree, for its name
+    Region region; //Absolute, in the image
+};
+
+//Files only refer to their directory, so no full path is built for any of them
+struct DumpPlan {
+    std::filesystem::path root;
+    std::vector<PlannedDirectory> dirs;
+    std::vector<PlannedFile> files;
+};
+
+auto dumpRegion(const std::filesystem::path &path, const Image &image, const Region &region, BufferPool *buffers = nullptr) -> bool;
+//Writes the region to stdout, for piping single files out of an image. Unencrypted data
+//is copied by the kernel from the image file where it can be, without being read in here.
+auto dumpRegionToStdout(const Image &image, const Region &region, BufferPool *buffers = nullptr) -> bool;
+
+//Planning creates the directories right away, so they exist before any file is written.
+//Each directory is made and opened relative to its parent's descriptor where the platform allows.
+//A directory that can't be made is reported, and nothing in it is planned.
+//planPath makes a directory under the root along with its missing parents, for single files and directories.
+auto planPath(DumpPlan &plan, const std::filesystem::path &relative) -> u32;
+void planFile(const DumpContext &context, u32 file, u32 dir, DumpPlan &plan);
+void planDirectory(const DumpContext &context, u32 dir, u32 parent, DumpPlan &plan);
+
+//Writes the files in the order their data is stored rather than in tree order, so the image is
+//read in one sequential sweep. Neighbouring files are grouped into runs of up to a few MB, and
+//the next run is prefetched with a single read-ahead hint while the current one is written.
+//Files are opened by name relative to a descriptor of their directory, held while it has files left.
+//With a pool this only queues the work, wait for the context's group before anything the context points to goes away.
+//With io_uring all of the files are written before this returns, the error is io_uring failing
+//in a way the files in flight can't be waited for.
+auto dumpPlan(const DumpContext &context, DumpPlan plan) -> Result<void>;
\ No newline at end of file
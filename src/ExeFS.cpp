@@ -1,39 +1,43 @@
 #include "ExeFS.hpp"
-#include "Scanner.hpp"
+#include "Layout.hpp"
 
 
-auto parseExeFSHeader(const std::vector<u8> &data, size_t offset) -> ExeFSHeader {
-    Scanner scanner(data);
-    scanner.seek(offset);
-    ExeFSHeader header;
-    
-    //File Headers
-    for(int i = 0; i < 10; i++) {
-        scanner.readBytes(header.file_headers[i].name, sizeof(ExeFSFileHeader::name));
-        header.file_headers[i].offset = scanner.readInt<u32>();
-        header.file_headers[i].size = scanner.readInt<u32>();
-    }
+namespace {
 
-    //File Hashes
-    for(int i = 0; i < 10; i++) {
-        scanner.readBytes(header.file_hashes[i], 32);
-    }
+constexpr auto EXEFS_FILE_HEADER_LAYOUT = layout<ExeFSFileHeader>(0x10,
+    field(&ExeFSFileHeader::name, 0x0),
+    field(&ExeFSFileHeader::offset, 0x8),
+    field(&ExeFSFileHeader::size, 0xC));
+static_assert(isValid(EXEFS_FILE_HEADER_LAYOUT));
 
+constexpr auto EXEFS_HEADER_LAYOUT = layout<ExeFSHeader>(0x200,
+    field(&ExeFSHeader::file_headers, 0x000, EXEFS_FILE_HEADER_LAYOUT),
+    field(&ExeFSHeader::file_hashes, 0x0C0));
+static_assert(isValid(EXEFS_HEADER_LAYOUT));
+
+} //namespace
+
+auto parseExeFSHeader(const Image &image, size_t offset) -> ExeFSHeader {
+    ExeFSHeader header{};
+    decode(EXEFS_HEADER_LAYOUT, image, offset, header);
     return header;
 }
 
-auto parseExeFS(const std::vector<u8> &data, size_t offset) -> ExeFS {
-    Scanner scanner(data);
+auto parseExeFS(const Image &image, const Region &region) -> Result<ExeFS> {
+    if(!image.contains(region) || region.size < EXEFS_HEADER_LAYOUT.size) {
+        return Error::format("ExeFS at 0x%zX (0x%zX bytes) is outside the image!", region.offset, region.size);
+    }
+
     ExeFS exefs;
-    exefs.header = parseExeFSHeader(data, offset);
+    exefs.header = parseExeFSHeader(image, region.offset);
     
-    //Get file data for each file if it exists
+    //Locate the data for each file, empty entries get an empty region
     for(int i = 0; i < 10; i++) {
-        if(exefs.header.file_headers[i].size > 0) {
-            size_t file_size = exefs.header.file_headers[i].size;
-            exefs.file_data[i].resize(file_size);
-            scanner.seek(offset + exefs.header.file_headers[i].offset + 0x200);
-            scanner.readBytes(exefs.file_data[i].data(), file_size);
+        exefs.file_data[i].offset = region.offset + exefs.header.file_headers[i].offset + 0x200;
+        exefs.file_data[i].size = exefs.header.file_headers[i].size;
+
+        if(exefs.file_data[i].size > 0 && !region.contains(exefs.file_data[i])) {
+            return Error::format("ExeFS file %i runs past the end of the ExeFS!", i);
         }
     }
 
@@ -1,7 +1,8 @@
 #pragma once
 
 #include "Types.hpp"
-#include <vector>
+#include "Image.hpp"
+#include "Result.hpp"
 
 
 struct ExeFSFileHeader {
@@ -18,8 +19,9 @@ struct ExeFSHeader {
 
 struct ExeFS {
     ExeFSHeader header;
-    std::vector<u8> file_data[10];
+    Region file_data[10];
 };
 
-auto parseExeFSHeader(const std::vector<u8> &data, size_t offset) -> ExeFSHeader;
-auto parseExeFS(const std::vector<u8> &data, size_t offset) -> ExeFS;
\ No newline at end of file
+auto parseExeFSHeader(const Image &image, size_t offset) -> ExeFSHeader;
+//The header and every file have to be inside the ExeFS region, which has to be inside the image
+auto parseExeFS(const Image &image, const Region &region) -> Result<ExeFS>;
\ No newline at end of file
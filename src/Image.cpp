@@ -0,0 +1,338 @@
+#include "Image.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+namespace {
+
+auto overlaps(const Region &a, const Region &b) -> bool {
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+} //namespace
+
+Image::~Image() {
+    close();
+}
+
+Image::Image(Image &&other) noexcept {
+    *this = std::move(other);
+}
+
+auto Image::operator=(Image &&other) noexcept -> Image& {
+    if(this != &other) {
+        close();
+        map = std::exchange(other.map, nullptr);
+        map_size = std::exchange(other.map_size, 0);
+        file = std::exchange(other.file, -1);
+        mapped = std::exchange(other.mapped, false);
+        bounded = std::exchange(other.bounded, false);
+        buffer = std::move(other.buffer);
+        modified = std::move(other.modified);
+        encrypted = std::move(other.encrypted);
+#ifdef _WIN32
+        file_handle = std::exchange(other.file_handle, nullptr);
+        mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+    }
+
+    return *this;
+}
+
+#ifdef _WIN32
+
+auto Image::open(const std::string &path) -> std::optional<Image> {
+    HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if(file_handle == INVALID_HANDLE_VALUE) {
+        return {};
+    }
+
+    return mapFile(file_handle);
+}
+
+auto Image::fromFd(int fd) -> std::optional<Image> {
+    const HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+    HANDLE file_handle = nullptr;
+
+    if(handle == INVALID_HANDLE_VALUE || !DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &file_handle, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        return {};
+    }
+
+    return mapFile(file_handle);
+}
+
+auto Image::mapFile(void *file_handle) -> std::optional<Image> {
+    Image image;
+    image.file_handle = file_handle;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(image.file_handle, &size)) {
+        return {};
+    }
+
+    image.map_size = static_cast<size_t>(size.QuadPart);
+    if(image.map_size == 0) {
+        return image;
+    }
+
+    //Copy-on-write, so metadata can be decrypted in place
+    image.mapping_handle = CreateFileMappingA(image.file_handle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if(image.mapping_handle == nullptr) {
+        return {};
+    }
+
+    image.map = static_cast<const u8*>(MapViewOfFile(image.mapping_handle, FILE_MAP_COPY, 0, 0, 0));
+    if(image.map == nullptr) {
+        return {};
+    }
+    image.mapped = true;
+
+    return image;
+}
+
+void Image::close() {
+    if(mapped) {
+        UnmapViewOfFile(map);
+    }
+
+    if(mapping_handle != nullptr) {
+        CloseHandle(mapping_handle);
+    }
+
+    if(file_handle != nullptr) {
+        CloseHandle(file_handle);
+    }
+
+    map = nullptr;
+    map_size = 0;
+    mapped = false;
+    buffer.clear();
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+
+void Image::advise(size_t offset, size_t length, Access access) const {
+    //No equivalent to madvise that is worth the trouble here
+}
+
+auto Image::writable(size_t offset, size_t length) -> u8* {
+    if(offset > map_size || length > map_size - offset) {
+        return nullptr;
+    }
+
+    if(!mapped) {
+        return copyOnWrite() + offset;
+    }
+
+    modified.push_back(Region{offset, length});
+    return const_cast<u8*>(map + offset);
+}
+
+#else
+
+auto Image::open(const std::string &path) -> std::optional<Image> {
+    const int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(file < 0) {
+        return {};
+    }
+
+    return mapFile(file);
+}
+
+auto Image::fromFd(int fd) -> std::optional<Image> {
+    const int file = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(file < 0) {
+        return {};
+    }
+
+    return mapFile(file);
+}
+
+auto Image::mapFile(int file) -> std::optional<Image> {
+    Image image;
+    image.file = file;
+
+    struct stat info;
+    if(fstat(image.file, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return {};
+    }
+
+    image.map_size = static_cast<size_t>(info.st_size);
+    if(image.map_size == 0) {
+        return image;
+    }
+
+    void *map = mmap(nullptr, image.map_size, PROT_READ, MAP_PRIVATE, image.file, 0);
+    if(map == MAP_FAILED) {
+        return {};
+    }
+    image.map = static_cast<const u8*>(map);
+    image.mapped = true;
+
+    //Parsing jumps all over the image, so don't let the kernel read ahead by default
+    image.advise(0, image.map_size, Access::Random);
+
+    return image;
+}
+
+void Image::close() {
+    if(mapped) {
+        munmap(const_cast<u8*>(map), map_size);
+    }
+
+    if(file >= 0) {
+        ::close(file);
+    }
+
+    map = nullptr;
+    map_size = 0;
+    mapped = false;
+    buffer.clear();
+    file = -1;
+}
+
+void Image::advise(size_t offset, size_t length, Access access) const {
+    if(!mapped || offset >= map_size) {
+        return;
+    }
+
+    //madvise needs a page aligned address
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t start = offset & ~(page_size - 1);
+    const size_t end = std::min(offset + length, map_size);
+
+    int advice = MADV_NORMAL;
+    switch(access) {
+        case Access::Normal: advice = MADV_NORMAL; break;
+        case Access::Random: advice = MADV_RANDOM; break;
+        case Access::Sequential: advice = MADV_SEQUENTIAL; break;
+        case Access::WillNeed: advice = MADV_WILLNEED; break;
+        case Access::DontNeed: advice = MADV_DONTNEED; break;
+    }
+
+    //Dropping the pages of a private mapping would throw away whatever was decrypted in place,
+    //madvise works on whole pages so the last one counts too
+    const Region range{start, ((end + page_size - 1) & ~(page_size - 1)) - start};
+    if(access == Access::DontNeed && std::any_of(modified.begin(), modified.end(), [&range](const Region &region) { return overlaps(range, region); })) {
+        return;
+    }
+
+    madvise(const_cast<u8*>(map + start), end - start, advice);
+
+    //The dumper copies through the file rather than the mapping, so its page cache gets the
+    //same hints. Only the ones about a range though, random access on the file would turn
+    //off read-ahead for the copies as well.
+    if(access == Access::Sequential || access == Access::WillNeed) {
+        posix_fadvise(file, static_cast<off_t>(offset), static_cast<off_t>(end - offset), access == Access::Sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_WILLNEED);
+    }
+}
+
+auto Image::writable(size_t offset, size_t length) -> u8* {
+    if(offset > map_size || length > map_size - offset) {
+        return nullptr;
+    }
+
+    if(!mapped) {
+        return copyOnWrite() + offset;
+    }
+
+    //mprotect needs a page aligned address
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t start = offset & ~(page_size - 1);
+
+    if(length > 0 && mprotect(const_cast<u8*>(map + start), offset + length - start, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+
+    modified.push_back(Region{offset, length});
+    return const_cast<u8*>(map + offset);
+}
+
+#endif
+
+void Image::setBounded(bool enabled) {
+    bounded = enabled;
+}
+
+void Image::release(size_t offset, size_t length) const {
+    if(bounded) {
+        advise(offset, length, Access::DontNeed);
+    }
+}
+
+auto Image::data() const -> const u8* {
+    return map;
+}
+
+auto Image::size() const -> size_t {
+    return map_size;
+}
+
+auto Image::fd() const -> int {
+    return file;
+}
+
+auto Image::contains(const Region &region) const -> bool {
+    return Region{0, map_size}.contains(region);
+}
+
+auto Image::fromMemory(std::vector<u8> bytes) -> Image {
+    Image image;
+    image.buffer = std::move(bytes);
+    image.map = image.buffer.data();
+    image.map_size = image.buffer.size();
+    return image;
+}
+
+auto Image::view(const u8 *data, size_t size) -> Image {
+    Image image;
+    image.map = data;
+    image.map_size = size;
+    return image;
+}
+
+auto Image::copyOnWrite() -> u8* {
+    if(buffer.empty() && map_size > 0) {
+        buffer.assign(map, map + map_size);
+        map = buffer.data();
+    }
+
+    return buffer.data();
+}
+
+void Image::addEncrypted(EncryptedRegion region) {
+    encrypted.push_back(std::move(region));
+}
+
+auto Image::isEncrypted(const Region &region) const -> bool {
+    return std::any_of(encrypted.begin(), encrypted.end(), [&region](const EncryptedRegion &other) { return overlaps(region, other.region); });
+}
+
+auto Image::matchesFile(const Region &region) const -> bool {
+    return !isEncrypted(region) && std::none_of(modified.begin(), modified.end(), [&region](const Region &other) { return overlaps(region, other); });
+}
+
+void Image::read(size_t offset, u8 *out, size_t size) const {
+    std::memcpy(out, map + offset, size);
+
+    for(const auto &region : encrypted) {
+        const size_t start = std::max(offset, region.region.offset);
+        const size_t end = std::min(offset + size, region.region.offset + region.region.size);
+
+        if(start < end) {
+            region.cipher->crypt(region.counter, start - region.stream_offset, out + (start - offset), end - start);
+        }
+    }
+}
\ No newline at end of file
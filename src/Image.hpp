@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Types.hpp"
+#include "Crypto.hpp"
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+//Non-owning view of a range of an image, the offset is absolute from the start of the image
+struct Region {
+    size_t offset;
+    size_t size;
+
+    //Whether other lies entirely inside this region, without overflowing on bad offsets
+    auto contains(const Region &other) const -> bool {
+        return other.offset >= offset && other.offset - offset <= size && other.size <= size - (other.offset - offset);
+    }
+};
+
+//A range of the image that is still encrypted, read() decrypts it on the way out
+struct EncryptedRegion {
+    Region region;
+    size_t stream_offset; //Absolute offset the counter's keystream starts at
+    AESCounter counter;
+    std::shared_ptr<const AESCTR> cipher;
+};
+
+//Read-only, memory-mapped view of an input image. Nothing is read up front,
+//pages are only faulted in when the parsers or the dumper actually touch them.
+class Image {
+public:
+
+    enum class Access {
+        Normal,
+        Random,
+        Sequential,
+        WillNeed,
+        DontNeed
+    };
+
+    Image() = default;
+    ~Image();
+    Image(const Image&) = delete;
+    Image(Image &&other) noexcept;
+    auto operator=(const Image&) -> Image& = delete;
+    auto operator=(Image &&other) noexcept -> Image&;
+
+    static auto open(const std::string &path) -> std::optional<Image>;
+    //Maps a file the caller already has open, the caller keeps ownership of fd
+    static auto fromFd(int fd) -> std::optional<Image>;
+    //An image of bytes already in memory, e.g. headers read on their own
+    static auto fromMemory(std::vector<u8> bytes) -> Image;
+    //Memory the caller owns and keeps alive for as long as the image. It is never written to,
+    //the image takes a copy the first time something has to be decrypted in place.
+    static auto view(const u8 *data, size_t size) -> Image;
+
+    auto data() const -> const u8*;
+    auto size() const -> size_t;
+    auto fd() const -> int;
+    auto contains(const Region &region) const -> bool;
+
+    //Hint to the kernel how a range of the image is about to be accessed
+    void advise(size_t offset, size_t length, Access access) const;
+    //With bounded memory every user drops the ranges it is done with from the mapping, so only
+    //the pages being worked on stay resident. release() does nothing otherwise.
+    void setBounded(bool enabled);
+    void release(size_t offset, size_t length) const;
+
+    //Copy-on-write access to a range of the mapping, used to decrypt metadata in place.
+    //The file itself is never changed. Returns null if the range can't be made writable.
+    auto writable(size_t offset, size_t length) -> u8*;
+    void addEncrypted(EncryptedRegion region);
+
+    auto isEncrypted(const Region &region) const -> bool;
+    //Whether the mapping still holds the same bytes as the file, so the region can be copied straight from it
+    auto matchesFile(const Region &region) const -> bool;
+    //Copies a range of the image, decrypting the parts that are still encrypted
+    void read(size_t offset, u8 *out, size_t size) const;
+
+private:
+
+#ifdef _WIN32
+    static auto mapFile(void *file_handle) -> std::optional<Image>;
+#else
+    static auto mapFile(int file) -> std::optional<Image>;
+#endif
+    void close();
+    //The image's own copy of memory it doesn't own, made on the first write
+    auto copyOnWrite() -> u8*;
+
+    const u8 *map = nullptr;
+    size_t map_size = 0;
+    int file = -1;
+    bool mapped = false; //Whether map is a mapping of the file, rather than memory
+    bool bounded = false;
+    std::vector<u8> buffer; //Set instead of a mapping for images in memory
+    std::vector<Region> modified;
+    std::vector<EncryptedRegion> encrypted;
+#ifdef _WIN32
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Types.hpp"
+#include "Image.hpp"
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+
+//Decodes on-disk structs from a constexpr table of their fields. Every layout is checked
+//at compile time with static_assert(isValid(...)), so a field that overlaps another, is
+//out of order or runs past the end of the struct doesn't build. Decoding does a single
+//bounds check per struct and a memcpy per field.
+
+//Marks a field as plain little-endian integers, or bytes
+struct NoLayout {};
+
+//A member of Struct at a byte offset from the start of the struct on disk. Integers and
+//arrays of them are decoded as little-endian, anything else with its own nested layout.
+template<typename Struct, typename Member, typename Nested = NoLayout>
+struct Field {
+    using Owner = Struct;
+    using Element = std::remove_all_extents_t<Member>;
+    static constexpr size_t COUNT = sizeof(Member) / sizeof(Element);
+
+    Member Struct::*member;
+    size_t offset;
+    Nested nested;
+
+    constexpr auto size() const -> size_t {
+        if constexpr(std::is_same_v<Nested, NoLayout>) {
+            return sizeof(Member);
+        } else {
+            return COUNT * nested.size;
+        }
+    }
+};
+
+template<typename Struct, typename... Fields>
+struct Layout {
+    using Type = Struct;
+
+    size_t size; //On disk, reserved space included
+    std::tuple<Fields...> fields;
+};
+
+template<typename Struct, typename Member>
+constexpr auto field(Member Struct::*member, size_t offset) -> Field<Struct, Member> {
+    static_assert(std::is_integral_v<std::remove_all_extents_t<Member>>, "A field without a nested layout has to be integers");
+    return Field<Struct, Member>{member, offset, {}};
+}
+
+template<typename Struct, typename Member, typename Nested>
+constexpr auto field(Member Struct::*member, size_t offset, Nested nested) -> Field<Struct, Member, Nested> {
+    static_assert(std::is_same_v<typename Nested::Type, std::remove_all_extents_t<Member>>, "The nested layout is for a different struct");
+    return Field<Struct, Member, Nested>{member, offset, nested};
+}
+
+template<typename Struct, typename... Fields>
+constexpr auto layout(size_t size, Fields... fields) -> Layout<Struct, Fields...> {
+    static_assert((std::is_same_v<typename Fields::Owner, Struct> && ...), "A field belongs to a different struct");
+    return Layout<Struct, Fields...>{size, {fields...}};
+}
+
+//Fields have to be in ascending order, can't overlap and have to end inside the struct
+template<typename Struct, typename... Fields>
+constexpr auto isValid(const Layout<Struct, Fields...> &layout) -> bool {
+    size_t end = 0;
+    bool valid = true;
+
+    std::apply([&](const auto &...field) {
+        ((valid = valid && field.offset >= end && field.offset + field.size() <= layout.size, end = field.offset + field.size()), ...);
+    }, layout.fields);
+
+    return valid;
+}
+
+template<typename T>
+auto loadLittleEndian(const u8 *data) -> T {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    T swapped = 0;
+    for(size_t i = 0; i < sizeof(T); i++) {
+        swapped |= static_cast<T>((value >> (8 * i)) & 0xFF) << (8 * (sizeof(T) - 1 - i));
+    }
+    value = swapped;
+#endif
+    return value;
+}
+
+//count little-endian integers, a single memcpy on little-endian hosts
+template<typename T>
+void decodeArray(const u8 *data, T *out, size_t count) {
+    static_assert(std::is_integral_v<T>);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for(size_t i = 0; i < count; i++) {
+        out[i] = loadLittleEndian<T>(data + i * sizeof(T));
+    }
+#else
+    std::memcpy(out, data, count * sizeof(T));
+#endif
+}
+
+template<typename Struct, typename... Fields>
+void decode(const Layout<Struct, Fields...> &layout, const u8 *data, Struct &out);
+
+template<typename Struct, typename Member, typename Nested>
+void decodeField(const Field<Struct, Member, Nested> &field, const u8 *data, Struct &out) {
+    using Element = typename Field<Struct, Member, Nested>::Element;
+    Element *elements = reinterpret_cast<Element*>(&(out.*field.member));
+
+    if constexpr(std::is_same_v<Nested, NoLayout>) {
+        decodeArray(data, elements, Field<Struct, Member, Nested>::COUNT);
+    } else {
+        for(size_t i = 0; i < Field<Struct, Member, Nested>::COUNT; i++) {
+            decode(field.nested, data + i * field.nested.size, elements[i]);
+        }
+    }
+}
+
+//From raw bytes, which have to hold at least layout.size bytes
+template<typename Struct, typename... Fields>
+void decode(const Layout<Struct, Fields...> &layout, const u8 *data, Struct &out) {
+    std::apply([&](const auto &...field) { (decodeField(field, data + field.offset, out), ...); }, layout.fields);
+}
+
+//From an absolute offset in the image. Returns false and leaves out as it was if the struct doesn't fit.
+template<typename Struct, typename... Fields>
+auto decode(const Layout<Struct, Fields...> &layout, const Image &image, size_t offset, Struct &out) -> bool {
+    if(offset > image.size() || layout.size > image.size() - offset) {
+        return false;
+    }
+
+    decode(layout, image.data() + offset, out);
+    return true;
+}
\ No newline at end of file
@@ -1,167 +1,483 @@
 #include "NCCH.hpp"
-#include "Scanner.hpp"
-
-
-auto parseNCCHHeader(const std::vector<u8> &data, size_t offset) -> NCCHHeader {
-    Scanner scanner(data);
-    NCCHHeader header;
-
-    scanner.seek(offset);
-    scanner.readBytes(header.signature, sizeof(NCCHHeader::signature));
-    header.magic = scanner.readInt<u32>();
-    header.size = scanner.readInt<u32>();
-    header.partition_id = scanner.readInt<u64>();
-    header.maker_code = scanner.readInt<u16>();
-    header.version = scanner.readInt<u16>();
-    header.some_hash = scanner.readInt<u32>();
-    header.program_id = scanner.readInt<u64>();
-    scanner.skip(0x10);
-    scanner.readBytes(header.logo_hash, sizeof(NCCHHeader::logo_hash));
-    scanner.readBytes(header.product_code, sizeof(NCCHHeader::product_code));
-    scanner.readBytes(header.exheader_hash, sizeof(NCCHHeader::exheader_hash));
-    header.exheader_size = scanner.readInt<u32>();
-    scanner.skip(4);
-    scanner.readBytes(header.flags, sizeof(NCCHHeader::flags));
-    header.plain_offset = scanner.readInt<u32>();
-    header.plain_size = scanner.readInt<u32>();
-    header.logo_offset = scanner.readInt<u32>();
-    header.logo_size = scanner.readInt<u32>();
-    header.exefs_offset = scanner.readInt<u32>();
-    header.exefs_size = scanner.readInt<u32>();
-    header.exefs_hash_size = scanner.readInt<u32>();
-    scanner.skip(4);
-    header.romfs_offset = scanner.readInt<u32>();
-    header.romfs_size = scanner.readInt<u32>();
-    header.romfs_hash_size = scanner.readInt<u32>();
-    scanner.skip(4);
-    scanner.readBytes(header.exefs_super_hash, sizeof(NCCHHeader::exefs_super_hash));
-    scanner.readBytes(header.romfs_super_hash, sizeof(NCCHHeader::romfs_super_hash));
+#include "Layout.hpp"
+#include <cstring>
 
-    return header;
+
+namespace {
+
+//flags[7]
+constexpr u8 FIXED_CRYPTO_KEY = 0x01;
+constexpr u8 NO_CRYPTO = 0x04;
+constexpr u8 SEED_CRYPTO = 0x20;
+
+constexpr auto NCCH_HEADER_LAYOUT = layout<NCCHHeader>(0x200,
+    field(&NCCHHeader::signature, 0x000),
+    field(&NCCHHeader::magic, 0x100),
+    field(&NCCHHeader::size, 0x104),
+    field(&NCCHHeader::partition_id, 0x108),
+    field(&NCCHHeader::maker_code, 0x110),
+    field(&NCCHHeader::version, 0x112),
+    field(&NCCHHeader::some_hash, 0x114),
+    field(&NCCHHeader::program_id, 0x118),
+    field(&NCCHHeader::logo_hash, 0x130),
+    field(&NCCHHeader::product_code, 0x150),
+    field(&NCCHHeader::exheader_hash, 0x160),
+    field(&NCCHHeader::exheader_size, 0x180),
+    field(&NCCHHeader::flags, 0x188),
+    field(&NCCHHeader::plain_offset, 0x190),
+    field(&NCCHHeader::plain_size, 0x194),
+    field(&NCCHHeader::logo_offset, 0x198),
+    field(&NCCHHeader::logo_size, 0x19C),
+    field(&NCCHHeader::exefs_offset, 0x1A0),
+    field(&NCCHHeader::exefs_size, 0x1A4),
+    field(&NCCHHeader::exefs_hash_size, 0x1A8),
+    field(&NCCHHeader::romfs_offset, 0x1B0),
+    field(&NCCHHeader::romfs_size, 0x1B4),
+    field(&NCCHHeader::romfs_hash_size, 0x1B8),
+    field(&NCCHHeader::exefs_super_hash, 0x1C0),
+    field(&NCCHHeader::romfs_super_hash, 0x1E0));
+static_assert(isValid(NCCH_HEADER_LAYOUT));
+
+constexpr auto CODE_SET_INFO_LAYOUT = layout<CodeSetInfo>(0xC,
+    field(&CodeSetInfo::address, 0x0),
+    field(&CodeSetInfo::region_size, 0x4),
+    field(&CodeSetInfo::size, 0x8));
+static_assert(isValid(CODE_SET_INFO_LAYOUT));
+
+constexpr auto SYSTEM_CONTROL_INFO_LAYOUT = layout<SystemControlInfo>(0x200,
+    field(&SystemControlInfo::app_title, 0x00),
+    field(&SystemControlInfo::flag, 0x0D),
+    field(&SystemControlInfo::remaster_version, 0x0E),
+    field(&SystemControlInfo::text_info, 0x10, CODE_SET_INFO_LAYOUT),
+    field(&SystemControlInfo::stack_size, 0x1C),
+    field(&SystemControlInfo::ro_info, 0x20, CODE_SET_INFO_LAYOUT),
+    field(&SystemControlInfo::data_info, 0x30, CODE_SET_INFO_LAYOUT),
+    field(&SystemControlInfo::bss_size, 0x3C),
+    field(&SystemControlInfo::dependency_list, 0x40),
+    field(&SystemControlInfo::savedata_size, 0x1C0),
+    field(&SystemControlInfo::jump_id, 0x1C8));
+static_assert(isValid(SYSTEM_CONTROL_INFO_LAYOUT));
+
+constexpr auto ACCESS_CONTROL_INFO_LAYOUT = layout<AccessControlInfo>(0x200,
+    field(&AccessControlInfo::program_id, 0x000),
+    field(&AccessControlInfo::core_version, 0x008),
+    field(&AccessControlInfo::flag1, 0x00C),
+    field(&AccessControlInfo::flag2, 0x00D),
+    field(&AccessControlInfo::flag0, 0x00E),
+    field(&AccessControlInfo::priority, 0x00F),
+    field(&AccessControlInfo::resource_limits, 0x010),
+    field(&AccessControlInfo::extdata_id, 0x030),
+    field(&AccessControlInfo::sys_savedata_ids, 0x038),
+    field(&AccessControlInfo::storage_unique_ids, 0x040),
+    field(&AccessControlInfo::fs_access_and_other, 0x048),
+    field(&AccessControlInfo::service_access_control, 0x050),
+    field(&AccessControlInfo::extended_service_access_control, 0x150),
+    field(&AccessControlInfo::resource_limit_category, 0x16F),
+    field(&AccessControlInfo::arm11_descriptors, 0x170),
+    field(&AccessControlInfo::arm9_descriptors, 0x1F0),
+    field(&AccessControlInfo::arm9_descriptor_version, 0x1FF));
+static_assert(isValid(ACCESS_CONTROL_INFO_LAYOUT));
+
+constexpr auto NCCH_EXTENDED_HEADER_LAYOUT = layout<NCCHExtendedHeader>(0x800,
+    field(&NCCHExtendedHeader::sci, 0x000, SYSTEM_CONTROL_INFO_LAYOUT),
+    field(&NCCHExtendedHeader::aci, 0x200, ACCESS_CONTROL_INFO_LAYOUT),
+    field(&NCCHExtendedHeader::signature, 0x400),
+    field(&NCCHExtendedHeader::public_key, 0x500),
+    field(&NCCHExtendedHeader::aci_limits, 0x600, ACCESS_CONTROL_INFO_LAYOUT));
+static_assert(isValid(NCCH_EXTENDED_HEADER_LAYOUT));
+
+//The KeyX slot of the secondary key, used for the RomFS and .code
+auto secondaryKeySlot(u8 crypto_method) -> int {
+    switch(crypto_method) {
+        case 0x00: return 0x2C;
+        case 0x01: return 0x25;
+        case 0x0A: return 0x18;
+        case 0x0B: return 0x1B;
+        default: return -1;
+    }
 }
 
-auto parseSystemControlInfo(const std::vector<u8> &data, size_t offset) -> SystemControlInfo {
-    Scanner scanner(data);
-    SystemControlInfo sci;
-
-    scanner.seek(offset);
-    scanner.readBytes(sci.app_title, sizeof(SystemControlInfo::app_title));
-    scanner.skip(5);
-    sci.flag = scanner.readInt<u8>();
-    sci.remaster_version = scanner.readInt<u16>();
-    sci.text_info.address = scanner.readInt<u32>();
-    sci.text_info.region_size = scanner.readInt<u32>();
-    sci.text_info.size = scanner.readInt<u32>();
-    sci.stack_size = scanner.readInt<u32>();
-    sci.ro_info.address = scanner.readInt<u32>();
-    sci.ro_info.region_size = scanner.readInt<u32>();
-    sci.ro_info.size = scanner.readInt<u32>();
-    scanner.skip(4);
-    sci.data_info.address = scanner.readInt<u32>();
-    sci.data_info.region_size = scanner.readInt<u32>();
-    sci.data_info.size = scanner.readInt<u32>();
-    sci.bss_size = scanner.readInt<u32>();
-    
-    for(int i = 0; i < sizeof(SystemControlInfo::dependency_list) / sizeof(u32); i++) {
-        sci.dependency_list[i] = scanner.readInt<u32>();
-    }
-
-    sci.savedata_size = scanner.readInt<u64>();
-    sci.jump_id = scanner.readInt<u64>();
+auto decryptInPlace(Image &image, const Region &region, const AESCTR &cipher, const AESCounter &counter, size_t stream_offset) -> bool {
+    u8 *data = image.writable(region.offset, region.size);
+    if(data == nullptr) {
+        return false;
+    }
 
-    return sci;
+    cipher.crypt(counter, region.offset - stream_offset, data, region.size);
+    return true;
 }
 
-auto parseAccessControlInfo(const std::vector<u8> &data, size_t offset) -> AccessControlInfo {
-    Scanner scanner(data);
-    AccessControlInfo aci;
+auto decryptRomFS(Image &image, const Region &romfs, std::shared_ptr<const AESCTR> cipher, const AESCounter &counter) -> bool {
+    auto inRomFS = [&romfs](const Region &region) {
+        return region.offset >= romfs.offset && region.offset - romfs.offset <= romfs.size && region.size <= romfs.size - (region.offset - romfs.offset);
+    };
+    auto decrypt = [&](const Region &region) {
+        return inRomFS(region) && decryptInPlace(image, region, *cipher, counter, romfs.offset);
+    };
 
-    scanner.seek(offset);
-    aci.program_id = scanner.readInt<u64>();
-    aci.core_version = scanner.readInt<u32>();
-    aci.flag1 = scanner.readInt<u8>();
-    aci.flag2 = scanner.readInt<u8>();
-    aci.flag0 = scanner.readInt<u8>();
-    aci.priority = scanner.readInt<u8>();
+    //The header has to be decrypted before the level offsets can be worked out
+    if(!decrypt(Region{romfs.offset, 0x60})) {
+        return false;
+    }
 
-    for(int i = 0; i < sizeof(AccessControlInfo::resource_limits) / sizeof(u16); i++) {
-        aci.resource_limits[i] = scanner.readInt<u16>();
+    const RomFSHeader header = parseRomFSHeader(image, romfs.offset);
+    IVFCLevel levels[3];
+    if(!getIVFCLevels(header, romfs.offset, levels)) {
+        return false;
     }
 
-    aci.extdata_id = scanner.readInt<u64>();
-    aci.sys_savedata_ids = scanner.readInt<u64>();
-    aci.storage_unique_ids = scanner.readInt<u64>();
-    aci.fs_access_and_other = scanner.readInt<u64>();
-    scanner.readBytes(reinterpret_cast<u8*>(aci.service_access_control), sizeof(AccessControlInfo::service_access_control));
-    scanner.readBytes(reinterpret_cast<u8*>(aci.extended_service_access_control), sizeof(AccessControlInfo::extended_service_access_control));
-    scanner.skip(0xF);
-    aci.resource_limit_category = scanner.readInt<u8>();
+    //Master hash, level 1 and level 2 are small, level 3 only has its metadata decrypted in place
+    const size_t level3 = levels[2].data.offset;
+    if(!decrypt(Region{romfs.offset + 0x60, level3 - (romfs.offset + 0x60)}) || !decrypt(levels[0].data) || !decrypt(levels[1].data)
+        || !decrypt(Region{level3, 0x28})) {
+        return false;
+    }
 
-    for(int i = 0; i < sizeof(AccessControlInfo::arm11_descriptors) / sizeof(u32); i++) {
-        aci.arm11_descriptors[i] = scanner.readInt<u32>();
+    const size_t file_data_offset = parseLevel3Header(image, level3).file_data_offset;
+    if(file_data_offset < 0x28 || file_data_offset > levels[2].data.size || !decrypt(Region{level3 + 0x28, file_data_offset - 0x28})) {
+        return false;
     }
 
-    scanner.skip(0x10);
-    scanner.readBytes(aci.arm9_descriptors, sizeof(AccessControlInfo::arm9_descriptors));
-    aci.arm9_descriptor_version = scanner.readInt<u8>();
+    image.addEncrypted(EncryptedRegion{Region{level3 + file_data_offset, levels[2].data.size - file_data_offset}, romfs.offset, counter, std::move(cipher)});
+    return true;
+}
 
-    return aci;
+//The dumper reads file data straight from the image, so it has to be inside the RomFS section
+auto checkFileData(Result<RomFS> romfs, const Region &section) -> Result<RomFS> {
+    if(romfs && !section.contains(romfs.value().level3.file_data)) {
+        const Region &file_data = romfs.value().level3.file_data;
+        return Error::format("RomFS file data at 0x%zX (0x%zX bytes) runs past the end of the RomFS!", file_data.offset, file_data.size);
+    }
+
+    return romfs;
+}
+
+} //namespace
+
+
+auto parseNCCHHeader(const Image &image, size_t offset) -> NCCHHeader {
+    NCCHHeader header{};
+    decode(NCCH_HEADER_LAYOUT, image, offset, header);
+    return header;
 }
 
-auto parseNCCHExtendedHeader(const std::vector<u8> &data, size_t offset) -> NCCHExtendedHeader {
-    Scanner scanner(data);
-    NCCHExtendedHeader exheader;
+auto parseSystemControlInfo(const Image &image, size_t offset) -> SystemControlInfo {
+    SystemControlInfo sci{};
+    decode(SYSTEM_CONTROL_INFO_LAYOUT, image, offset, sci);
+    return sci;
+}
 
-    scanner.seek(offset);
-    exheader.sci = parseSystemControlInfo(data, 0);
-    exheader.aci = parseAccessControlInfo(data, 0x200);
-    scanner.readBytes(exheader.signature, sizeof(NCCHExtendedHeader::signature));
-    scanner.readBytes(exheader.public_key, sizeof(NCCHExtendedHeader::public_key));
-    exheader.aci_limits = parseAccessControlInfo(data, 0x600);
+auto parseAccessControlInfo(const Image &image, size_t offset) -> AccessControlInfo {
+    AccessControlInfo aci{};
+    decode(ACCESS_CONTROL_INFO_LAYOUT, image, offset, aci);
+    return aci;
+}
 
+auto parseNCCHExtendedHeader(const Image &image, size_t offset) -> NCCHExtendedHeader {
+    NCCHExtendedHeader exheader{};
+    decode(NCCH_EXTENDED_HEADER_LAYOUT, image, offset, exheader);
     return exheader;
 }
 
-auto parseNCCH(const std::vector<u8> &data, size_t offset) -> NCCH {
-    Scanner scanner(data);
+auto NCCH::exheader() const -> const NCCHExtendedHeader* {
+    if(header.exheader_size == 0) {
+        return nullptr;
+    }
+
+    if(!exheader_cache.has_value()) {
+        exheader_cache = parseNCCHExtendedHeader(*image, offset + 0x200);
+    }
+
+    return &exheader_cache.value();
+}
+
+auto NCCH::exefs() const -> Result<const ExeFS*> {
+    if(header.exefs_size == 0) {
+        return nullptr;
+    }
+
+    if(!exefs_cache.has_value()) {
+        exefs_cache = parseExeFS(*image, mediaRegion(offset, header.exefs_offset, header.exefs_size));
+    }
+
+    if(!exefs_cache.value()) {
+        return exefs_cache->error();
+    }
+
+    return &exefs_cache->value();
+}
+
+auto NCCH::romfs() const -> Result<const RomFS*> {
+    if(header.romfs_size == 0) {
+        return nullptr;
+    }
+
+    if(!romfs_cache.has_value()) {
+        const Region section = mediaRegion(offset, header.romfs_offset, header.romfs_size);
+        romfs_cache = checkFileData(parseRomFS(*image, section.offset), section);
+    }
+
+    if(!romfs_cache.value()) {
+        return romfs_cache->error();
+    }
+
+    return &romfs_cache->value();
+}
+
+auto NCCH::romfs(const std::string &index_path, const RomFSIndexKey &key, std::vector<std::string> &warnings) const -> Result<const RomFS*> {
+    if(header.romfs_size == 0) {
+        return nullptr;
+    }
+
+    if(!romfs_cache.has_value()) {
+        const Region section = mediaRegion(offset, header.romfs_offset, header.romfs_size);
+        std::optional<RomFS> indexed = loadRomFSIndex(index_path, *image, section.offset, key);
+
+        if(indexed.has_value()) {
+            romfs_cache = checkFileData(std::move(indexed.value()), section);
+        } else {
+            romfs_cache = checkFileData(parseRomFS(*image, section.offset), section);
+            if(romfs_cache.value() && !saveRomFSIndex(index_path, romfs_cache->value(), key)) {
+                warnings.push_back("Failed to write RomFS index '" + index_path + "'");
+            }
+        }
+    }
+
+    if(!romfs_cache.value()) {
+        return romfs_cache->error();
+    }
+
+    return &romfs_cache->value();
+}
+
+auto lookupPath(const NCCH &ncch, std::string_view path) -> Result<std::optional<Region>> {
+    if(path == "logo") {
+        return ncch.logo;
+    } else if(path == "plain_region") {
+        return ncch.plain_region;
+    }
+
+    if(path.substr(0, 6) == "ExeFS/") {
+        const std::string_view name = path.substr(6);
+        const Result<const ExeFS*> exefs = ncch.exefs();
+        if(!exefs) {
+            return exefs.error();
+        }
+
+        for(int i = 0; exefs.value() != nullptr && i < 10; i++) {
+            const ExeFSFileHeader &file = exefs.value()->header.file_headers[i];
+            if(file.size > 0 && name.size() <= sizeof(file.name) && std::strncmp(reinterpret_cast<const char*>(file.name), name.data(), name.size()) == 0
+                && (name.size() == sizeof(file.name) || file.name[name.size()] == 0)) {
+                return std::optional<Region>(exefs.value()->file_data[i]);
+            }
+        }
+    } else if(path.substr(0, 6) == "RomFS/") {
+        const Result<const RomFS*> romfs = ncch.romfs();
+        if(!romfs) {
+            return romfs.error();
+        }
+
+        const std::optional<std::u16string> name = decodeUtf8(path.substr(6));
+        if(!name.has_value()) {
+            return Error{"The path '" + std::string(path) + "' isn't valid UTF-8!"};
+        }
+
+        const std::optional<u32> file = romfs.value() != nullptr ? lookupFile(*romfs.value(), name.value()) : std::nullopt;
+        if(file.has_value()) {
+            const RomFSTree &tree = romfs.value()->tree;
+            return std::optional<Region>(Region{romfs.value()->level3.file_data.offset + tree.file_offsets[file.value()], tree.file_sizes[file.value()]});
+        }
+    }
+
+    return std::optional<Region>();
+}
+
+auto isCodeCompressed(const NCCH &ncch) -> bool {
+    const NCCHExtendedHeader *exheader = ncch.exheader();
+    return exheader != nullptr && (exheader->sci.flag & 0x1) != 0;
+}
+
+auto mediaRegion(size_t offset, u32 media_offset, u32 media_size) -> Region {
+    return Region{offset + u64(media_offset) * 0x200, u64(media_size) * 0x200};
+}
+
+auto parseNCCH(const Image &image, size_t offset) -> Result<NCCH> {
+    if(!image.contains(Region{offset, NCCH_HEADER_LAYOUT.size})) {
+        return Error::format("NCCH header at 0x%zX is outside the image!", offset);
+    }
+
     NCCH ncch;
-    ncch.header = parseNCCHHeader(data, offset);
+    ncch.image = &image;
+    ncch.offset = offset;
+    ncch.header = parseNCCHHeader(image, offset);
 
     //Check magic 'NCCH'
     if(ncch.header.magic != 0x4843434E) {
-        printf("NCCH header magic doesn't match! (Expected: 0x4843434E, Actual: %08X)\n", ncch.header.magic);
-        std::exit(-1);
+        return Error::format("NCCH header magic doesn't match! (Expected: 0x4843434E, Actual: %08X)", ncch.header.magic);
     }
 
-    //Check for Extended Header
-    if(ncch.header.exheader_size > 0) {
-        ncch.exheader = parseNCCHExtendedHeader(data, offset + 0x200);
+    //Every section is checked here once, so nothing that reads them has to
+    const NCCHHeader &header = ncch.header;
+    const struct {
+        const char *name;
+        Region region;
+    } sections[] = {
+        {"ExHeader", Region{offset + 0x200, header.exheader_size > 0 ? NCCH_EXTENDED_HEADER_LAYOUT.size : 0}},
+        {"Plain Region", mediaRegion(offset, header.plain_offset, header.plain_size)},
+        {"Logo", mediaRegion(offset, header.logo_offset, header.logo_size)},
+        {"ExeFS", mediaRegion(offset, header.exefs_offset, header.exefs_size)},
+        {"RomFS", mediaRegion(offset, header.romfs_offset, header.romfs_size)}
+    };
+
+    for(const auto &section : sections) {
+        if(section.region.size > 0 && !image.contains(section.region)) {
+            return Error::format("NCCH %s at 0x%zX (0x%zX bytes) is outside the image!", section.name, section.region.offset, section.region.size);
+        }
     }
 
     //Check for Logo
-    if(ncch.header.logo_size > 0) {
-        ncch.logo = std::vector<u8>(ncch.header.logo_size * 0x200);
-        scanner.seek(offset + ncch.header.logo_offset * 0x200);
-        scanner.readBytes(ncch.logo->data(), ncch.header.logo_size * 0x200);
+    if(header.logo_size > 0) {
+        ncch.logo = mediaRegion(offset, header.logo_offset, header.logo_size);
     }
 
     //Check for Plain Region
-    if(ncch.header.plain_size > 0) {
-        ncch.plain_region = std::vector<u8>(ncch.header.plain_size * 0x200);
-        scanner.seek(offset + ncch.header.plain_offset * 0x200);
-        scanner.readBytes(ncch.plain_region->data(), ncch.header.plain_size * 0x200);
+    if(header.plain_size > 0) {
+        ncch.plain_region = mediaRegion(offset, header.plain_offset, header.plain_size);
+    }
+
+    //The extended header, ExeFS and RomFS are parsed on demand
+
+    return ncch;
+}
+
+auto isNCCHEncrypted(const NCCHHeader &header) -> bool {
+    return (header.flags[7] & NO_CRYPTO) == 0;
+}
+
+auto getNCCHKeys(const NCCHHeader &header, const KeyFile *keys) -> Result<NCCHKeys> {
+    const u8 crypto_flags = header.flags[7];
+
+    if(crypto_flags & SEED_CRYPTO) {
+        return Error{"The partition uses seed crypto, which isn't supported!"};
     }
 
-    //Check for ExeFS
-    if(ncch.header.exefs_size > 0) {
-        ncch.exefs = parseExeFS(data, offset + ncch.header.exefs_offset * 0x200);
+    //Fixed key partitions use a key of all zeros, unless they are system titles
+    if(crypto_flags & FIXED_CRYPTO_KEY) {
+        if(header.program_id & (u64(0x10) << 32)) {
+            return Error{"The partition uses the fixed system key, which isn't supported!"};
+        }
+
+        return NCCHKeys{};
     }
 
-    //Check for RomFS
-    if(ncch.header.romfs_size > 0) {
-        scanner.seek(offset + ncch.header.romfs_offset * 0x200);
-        ncch.romfs = parseRomFS(data, offset + ncch.header.romfs_offset * 0x200);
+    const int slot = secondaryKeySlot(header.flags[3]);
+
+    if(slot < 0) {
+        return Error::format("Unknown crypto method 0x%02X!", header.flags[3]);
     }
 
-    return ncch;
+    if(keys == nullptr) {
+        return Error{"The partition is encrypted, a key file has to be provided with '--keys'!"};
+    }
+
+    for(int needed : {0x2C, slot}) {
+        if(!keys->key_x[needed].has_value()) {
+            return Error::format("slot0x%02XKeyX is missing from the key file!", needed);
+        }
+    }
+
+    if(!keys->generator.has_value()) {
+        return Error{"generator is missing from the key file!"};
+    }
+
+    //KeyY is the start of the header's signature
+    AESKey key_y;
+    std::memcpy(key_y.data(), header.signature, key_y.size());
+
+    return NCCHKeys{
+        scrambleKey(keys->key_x[0x2C].value(), key_y, keys->generator.value()),
+        scrambleKey(keys->key_x[slot].value(), key_y, keys->generator.value())
+    };
+}
+
+auto getNCCHCounter(const NCCHHeader &header, NCCHCryptoSection section, u64 section_offset) -> AESCounter {
+    AESCounter counter{};
+
+    if(header.version == 1) {
+        //The partition ID in little-endian, then the section's offset in bytes
+        for(int i = 0; i < 8; i++) {
+            counter[i] = header.partition_id >> (i * 8);
+        }
+        for(int i = 0; i < 4; i++) {
+            counter[12 + i] = section_offset >> ((3 - i) * 8);
+        }
+    } else {
+        //The partition ID in big-endian, then the section type
+        for(int i = 0; i < 8; i++) {
+            counter[i] = header.partition_id >> ((7 - i) * 8);
+        }
+        counter[8] = section;
+    }
+
+    return counter;
+}
+
+auto decryptNCCH(Image &image, size_t offset, const KeyFile *keys) -> Result<void> {
+    const NCCHHeader header = parseNCCHHeader(image, offset);
+    if(!isNCCHEncrypted(header)) {
+        return {};
+    }
+
+    const Result<NCCHKeys> ncch_keys = getNCCHKeys(header, keys);
+    if(!ncch_keys) {
+        return ncch_keys.error();
+    }
+
+    const AESKey &primary_key = ncch_keys.value().primary;
+    const AESKey &secondary_key = ncch_keys.value().secondary;
+    const AESCTR primary(primary_key);
+    auto secondary = std::make_shared<const AESCTR>(secondary_key);
+
+    //ExHeader and access descriptor
+    if(header.exheader_size > 0) {
+        const Region region{offset + 0x200, 0x800};
+        if(!decryptInPlace(image, region, primary, getNCCHCounter(header, EXHEADER_SECTION, 0x200), region.offset)) {
+            return Error{"Failed to decrypt the ExHeader!"};
+        }
+    }
+
+    //The whole ExeFS uses the primary key except for .code
+    if(header.exefs_size > 0) {
+        const Region region = mediaRegion(offset, header.exefs_offset, header.exefs_size);
+        const AESCounter counter = getNCCHCounter(header, EXEFS_SECTION, u64(header.exefs_offset) * 0x200);
+
+        if(!decryptInPlace(image, region, primary, counter, region.offset)) {
+            return Error{"Failed to decrypt the ExeFS!"};
+        }
+
+        const ExeFSHeader exefs_header = parseExeFSHeader(image, region.offset);
+        for(const auto &file : exefs_header.file_headers) {
+            if(primary_key == secondary_key || file.size == 0 || std::strncmp(reinterpret_cast<const char*>(file.name), ".code", sizeof(file.name)) != 0) {
+                continue;
+            }
+
+            //Undo the primary keystream and apply the secondary one
+            const Region code{region.offset + 0x200 + file.offset, file.size};
+            if(code.offset - region.offset > region.size || code.size > region.size - (code.offset - region.offset)
+                || !decryptInPlace(image, code, primary, counter, region.offset) || !decryptInPlace(image, code, *secondary, counter, region.offset)) {
+                return Error{"Failed to decrypt .code!"};
+            }
+        }
+    }
+
+    if(header.romfs_size > 0) {
+        const Region region = mediaRegion(offset, header.romfs_offset, header.romfs_size);
+
+        if(region.offset > image.size() || region.size > image.size() - region.offset
+            || !decryptRomFS(image, region, secondary, getNCCHCounter(header, ROMFS_SECTION, u64(header.romfs_offset) * 0x200))) {
+            return Error{"Failed to decrypt the RomFS!"};
+        }
+    }
+
+    return {};
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include "ExeFS.hpp"
 #include "RomFS.hpp"
+#include "RomFSIndex.hpp"
+#include "Crypto.hpp"
+#include "Result.hpp"
 #include <optional>
 
 
@@ -54,7 +57,7 @@ struct SystemControlInfo {
     //4 bytes reserved
     CodeSetInfo data_info;
     u32 bss_size;
-    u32 dependency_list[0x30];
+    u64 dependency_list[0x30];
     //SystemInfo
     u64 savedata_size;
     u64 jump_id;
@@ -97,17 +100,66 @@ struct NCCHExtendedHeader {
     AccessControlInfo aci_limits;
 };
 
+//Only the header is parsed up front, the other sections are parsed the first
+//time they are accessed and cached. The accessors are not thread-safe.
 struct NCCH {
     NCCHHeader header;
-    std::optional<NCCHExtendedHeader> exheader;
-    std::optional<std::vector<u8>> logo;
-    std::optional<std::vector<u8>> plain_region;
-    std::optional<ExeFS> exefs;
-    std::optional<RomFS> romfs;
+    std::optional<Region> logo;
+    std::optional<Region> plain_region;
+
+    //These return nullptr if the section doesn't exist, and the ExeFS and RomFS an
+    //Error if they are invalid. Errors are cached like sections that parsed.
+    auto exheader() const -> const NCCHExtendedHeader*;
+    auto exefs() const -> Result<const ExeFS*>;
+    auto romfs() const -> Result<const RomFS*>;
+    //Loads the RomFS from a sidecar index if it is valid, otherwise parses it and writes the index.
+    //Failing to write the index isn't an error, it is added to warnings instead.
+    auto romfs(const std::string &index_path, const RomFSIndexKey &key, std::vector<std::string> &warnings) const -> Result<const RomFS*>;
+
+    const Image *image;
+    size_t offset;
+    mutable std::optional<NCCHExtendedHeader> exheader_cache;
+    mutable std::optional<Result<ExeFS>> exefs_cache;
+    mutable std::optional<Result<RomFS>> romfs_cache;
+};
+
+//A section given in media units (0x200 bytes) from the start of a container, computed in 64 bits
+auto mediaRegion(size_t offset, u32 media_offset, u32 media_size) -> Region;
+
+auto parseNCCHHeader(const Image &image, size_t offset) -> NCCHHeader;
+auto parseSystemControlInfo(const Image &image, size_t offset) -> SystemControlInfo;
+auto parseAccessControlInfo(const Image &image, size_t offset) -> AccessControlInfo;
+auto parseNCCHExtendedHeader(const Image &image, size_t offset) -> NCCHExtendedHeader;
+//Checks the magic and that every section the header lists is inside the image
+auto parseNCCH(const Image &image, size_t offset) -> Result<NCCH>;
+
+//Finds a file of the partition by a UTF-8 path laid out the same way as a dump: 'RomFS/dir/file',
+//'ExeFS/.code', 'logo' or 'plain_region'. Empty if there is no such file, an Error if the section it
+//would be in is invalid or the path isn't UTF-8. The partition has to have been decrypted first.
+auto lookupPath(const NCCH &ncch, std::string_view path) -> Result<std::optional<Region>>;
+//If the ExHeader says .code is BLZ compressed, see decompressBLZ()
+auto isCodeCompressed(const NCCH &ncch) -> bool;
+
+enum NCCHCryptoSection : u8 {
+    EXHEADER_SECTION = 1,
+    EXEFS_SECTION = 2,
+    ROMFS_SECTION = 3
 };
 
-auto parseNCCHHeader(const std::vector<u8> &data, size_t offset) -> NCCHHeader;
-auto parseSystemControlInfo(const std::vector<u8> &data, size_t offset) -> SystemControlInfo;
-auto parseAccessControlInfo(const std::vector<u8> &data, size_t offset) -> AccessControlInfo;
-auto parseNCCHExtendedHeader(const std::vector<u8> &data, size_t offset) -> NCCHExtendedHeader;
-auto parseNCCH(const std::vector<u8> &data, size_t offset) -> NCCH;
\ No newline at end of file
+//The normal keys of an encrypted NCCH. The primary key is used for the ExHeader and
+//most of the ExeFS, the secondary key for .code and the RomFS.
+struct NCCHKeys {
+    AESKey primary;
+    AESKey secondary;
+};
+
+auto isNCCHEncrypted(const NCCHHeader &header) -> bool;
+//An Error with the reason if the keys can't be worked out
+auto getNCCHKeys(const NCCHHeader &header, const KeyFile *keys) -> Result<NCCHKeys>;
+auto getNCCHCounter(const NCCHHeader &header, NCCHCryptoSection section, u64 section_offset) -> AESCounter;
+
+//Decrypts the ExHeader, ExeFS and RomFS metadata of an encrypted NCCH in place. The
+//RomFS file data is left encrypted and registered with the image, so it's decrypted
+//in chunks as it's read. Does nothing if the NCCH isn't encrypted. Has to be called
+//before any of the sections are accessed, keys can be null if there is no key file.
+auto decryptNCCH(Image &image, size_t offset, const KeyFile *keys) -> Result<void>;
\ No newline at end of file
@@ -1,64 +1,87 @@
 #include "NCSD.hpp"
 #include "NCCH.hpp"
-#include "Scanner.hpp"
-
-auto parseNCSDHeader(const std::vector<u8> &data, size_t offset) -> NCSDHeader {
-    Scanner scanner(data);
-    NCSDHeader header;
-
-    scanner.seek(offset);
-    scanner.readBytes(header.signature, sizeof(NCSDHeader::signature));
-    header.magic = scanner.readInt<u32>();
-    header.size = scanner.readInt<u32>();
-    header.media_id = scanner.readInt<u64>();
-    header.fs_type = scanner.readInt<u64>();
-    header.crypt_type = scanner.readInt<u64>();
-
-    for(int i = 0; i < 8; i++) {
-        header.partition_table[i][0] = scanner.readInt<u32>();
-        header.partition_table[i][1] = scanner.readInt<u32>();
-    }
+#include "Layout.hpp"
+
+namespace {
+
+constexpr auto NCSD_HEADER_LAYOUT = layout<NCSDHeader>(0x160,
+    field(&NCSDHeader::signature, 0x000),
+    field(&NCSDHeader::magic, 0x100),
+    field(&NCSDHeader::size, 0x104),
+    field(&NCSDHeader::media_id, 0x108),
+    field(&NCSDHeader::fs_type, 0x110),
+    field(&NCSDHeader::crypt_type, 0x118),
+    field(&NCSDHeader::partition_table, 0x120));
+static_assert(isValid(NCSD_HEADER_LAYOUT));
+
+//Follows the NCSD header, at 0x160
+constexpr auto NCSD_CART_HEADER_LAYOUT = layout<NCSDCartHeader>(0x70,
+    field(&NCSDCartHeader::exheader_hash, 0x00),
+    field(&NCSDCartHeader::header_size, 0x20),
+    field(&NCSDCartHeader::sector_zero_offset, 0x24),
+    field(&NCSDCartHeader::partition_flags, 0x28),
+    field(&NCSDCartHeader::partition_id_table, 0x30));
+static_assert(isValid(NCSD_CART_HEADER_LAYOUT));
+
+} //namespace
 
+auto parseNCSDHeader(const Image &image, size_t offset) -> NCSDHeader {
+    NCSDHeader header{};
+    decode(NCSD_HEADER_LAYOUT, image, offset, header);
     return header;
 }
 
-auto parseNCSDCartHeader(const std::vector<u8> &data, size_t offset) -> NCSDCartHeader {
-    Scanner scanner(data);
-    NCSDCartHeader header;
+auto parseNCSDCartHeader(const Image &image, size_t offset) -> NCSDCartHeader {
+    NCSDCartHeader header{};
+    decode(NCSD_CART_HEADER_LAYOUT, image, offset, header);
+    return header;
+}
 
-    scanner.seek(offset);
-    scanner.readBytes(header.exheader_hash, sizeof(NCSDCartHeader::exheader_hash));
-    header.header_size = scanner.readInt<u32>();
-    header.sector_zero_offset = scanner.readInt<u32>();
-    header.partition_flags = scanner.readInt<u64>();
+auto NCSD::hasPartition(int index) const -> bool {
+    //Determine if a partition exists by a non-zero size
+    return index >= 0 && index < 8 && header.partition_table[index][1] != 0;
+}
 
-    for(int i = 0; i < 8; i++) {
-        header.partition_id_table[i] = scanner.readInt<u64>();
+auto NCSD::partition(int index) const -> Result<const NCCH*> {
+    if(!hasPartition(index)) {
+        return nullptr;
     }
 
-    return header;
+    if(!partitions[index].has_value()) {
+        const Region region = mediaRegion(offset, header.partition_table[index][0], header.partition_table[index][1]);
+        if(image->contains(region)) {
+            partitions[index] = parseNCCH(*image, region.offset);
+        } else {
+            partitions[index] = Error::format("Partition %i at 0x%zX (0x%zX bytes) is outside the image!", index, region.offset, region.size);
+        }
+    }
+
+    if(!partitions[index].value()) {
+        return partitions[index]->error();
+    }
+
+    return &partitions[index]->value();
 }
 
-auto parseNCSD(const std::vector<u8> &data, size_t offset) -> NCSD {
+auto parseNCSD(const Image &image, size_t offset) -> Result<NCSD> {
+    if(!image.contains(Region{offset, NCSD_HEADER_LAYOUT.size + NCSD_CART_HEADER_LAYOUT.size})) {
+        return Error::format("NCSD header at 0x%zX is outside the image!", offset);
+    }
+
     NCSD ncsd;
-    ncsd.header = parseNCSDHeader(data, offset);
+    ncsd.image = &image;
+    ncsd.offset = offset;
+    ncsd.header = parseNCSDHeader(image, offset);
 
     //Check magic 'NCSD'
     if(ncsd.header.magic != 0x4453434E) {
-        printf("NCSD header magic doesn't match! (Expected: 0x4453434E, Actual: %08X)\n", ncsd.header.magic);
-        std::exit(-1);
+        return Error::format("NCSD header magic doesn't match! (Expected: 0x4453434E, Actual: %08X)", ncsd.header.magic);
     }
 
     //Cart Header Section
-    ncsd.cart_header = parseNCSDCartHeader(data, offset + 0x160);
+    ncsd.cart_header = parseNCSDCartHeader(image, offset + 0x160);
 
-    //NCCH Partitions
-    for(int i = 0; i < 8; i++) {
-        //Determine if a partition exists by a non-zero size
-        if(ncsd.header.partition_table[i][1] != 0) {
-            ncsd.partitions[i] = parseNCCH(data, ncsd.header.partition_table[i][0] * 0x200);
-        }
-    }
+    //The NCCH partitions are parsed on demand
 
     return ncsd;
 }
\ No newline at end of file
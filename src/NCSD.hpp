@@ -29,12 +29,21 @@ struct NCSDCartHeader {
     //1 byte used for save encrpytion, or something
 };
 
+//Partitions are only parsed the first time they are accessed and cached.
+//The accessor is not thread-safe.
 struct NCSD {
     NCSDHeader header;
     NCSDCartHeader cart_header;
-    std::optional<NCCH> partitions[8];
+
+    auto hasPartition(int index) const -> bool;
+    //nullptr if the partition doesn't exist, an Error if it is invalid
+    auto partition(int index) const -> Result<const NCCH*>;
+
+    const Image *image;
+    size_t offset;
+    mutable std::optional<Result<NCCH>> partitions[8];
 };
 
-auto parseNCSDHeader(const std::vector<u8> &data, size_t offset) -> NCSDHeader;
-auto parseNCSDCartHeader(const std::vector<u8> &data, size_t offset) -> NCSDCartHeader;
-auto parseNCSD(const std::vector<u8> &data, size_t offset) -> NCSD;
\ No newline at end of file
+auto parseNCSDHeader(const Image &image, size_t offset) -> NCSDHeader;
+auto parseNCSDCartHeader(const Image &image, size_t offset) -> NCSDCartHeader;
+auto parseNCSD(const Image &image, size_t offset) -> Result<NCSD>;
\ No newline at end of file
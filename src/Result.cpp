@@ -0,0 +1,22 @@
+#include "Result.hpp"
+#include <cstdarg>
+#include <cstdio>
+
+
+auto Error::format(const char *format, ...) -> Error {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    const int length = std::vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+
+    Error error;
+    if(length > 0) {
+        error.message.resize(length);
+        std::vsnprintf(error.message.data(), length + 1, format, args);
+    }
+
+    va_end(args);
+    return error;
+}
\ No newline at end of file
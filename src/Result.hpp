@@ -0,0 +1,56 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+
+//Why an image couldn't be parsed, with a message that can be printed as is
+struct Error {
+    std::string message;
+
+    //Builds the message with printf formatting
+    static auto format(const char *format, ...) -> Error
+#if defined(__GNUC__)
+        __attribute__((format(printf, 1, 2)))
+#endif
+        ;
+};
+
+//The parsers return either what they parsed or an Error, they never exit. Bad images can
+//be skipped and the next one parsed in the same process.
+template<typename T>
+class Result {
+public:
+
+    Result(T value) : result(std::in_place_index<0>, std::move(value)) {}
+    Result(Error error) : result(std::in_place_index<1>, std::move(error)) {}
+
+    explicit operator bool() const { return result.index() == 0; }
+
+    auto value() -> T& { return std::get<0>(result); }
+    auto value() const -> const T& { return std::get<0>(result); }
+    auto error() const -> const Error& { return std::get<1>(result); }
+
+private:
+
+    std::variant<T, Error> result;
+};
+
+//For calls that only succeed or fail
+template<>
+class Result<void> {
+public:
+
+    Result() = default;
+    Result(Error error) : failure(std::move(error)) {}
+
+    explicit operator bool() const { return !failure.has_value(); }
+
+    auto error() const -> const Error& { return failure.value(); }
+
+private:
+
+    std::optional<Error> failure;
+};
\ No newline at end of file
@@ -1,217 +1,609 @@
 #include "RomFS.hpp"
-#include "Scanner.hpp"
+#include "Layout.hpp"
+#include <algorithm>
 #include <memory>
 
 
-auto parseLevel3Header(const std::vector<u8> &data, size_t offset) -> Level3Header {
-    Scanner scanner(data);
-    Level3Header header;
+namespace {
+
+constexpr u32 NO_ENTRY = 0xFFFFFFFF;
+constexpr u64 MAX_LEVEL_SIZE = u64(1) << 40;
+
+constexpr auto ROMFS_HEADER_LAYOUT = layout<RomFSHeader>(0x5C,
+    field(&RomFSHeader::magic, 0x00),
+    field(&RomFSHeader::magic_num, 0x04),
+    field(&RomFSHeader::master_hash_size, 0x08),
+    field(&RomFSHeader::lvl1_offset, 0x0C),
+    field(&RomFSHeader::lvl1_hash_size, 0x14),
+    field(&RomFSHeader::lvl1_block_size, 0x1C),
+    field(&RomFSHeader::lvl2_offset, 0x24),
+    field(&RomFSHeader::lvl2_hash_size, 0x2C),
+    field(&RomFSHeader::lvl2_block_size, 0x34),
+    field(&RomFSHeader::lvl3_offset, 0x3C),
+    field(&RomFSHeader::lvl3_hash_size, 0x44),
+    field(&RomFSHeader::lvl3_block_size, 0x4C),
+    field(&RomFSHeader::optional_info_size, 0x58));
+static_assert(isValid(ROMFS_HEADER_LAYOUT));
+
+constexpr auto LEVEL3_HEADER_LAYOUT = layout<Level3Header>(0x28,
+    field(&Level3Header::header_length, 0x00),
+    field(&Level3Header::dir_hash_offset, 0x04),
+    field(&Level3Header::dir_hash_length, 0x08),
+    field(&Level3Header::dir_meta_offset, 0x0C),
+    field(&Level3Header::dir_meta_length, 0x10),
+    field(&Level3Header::file_hash_offset, 0x14),
+    field(&Level3Header::file_hash_length, 0x18),
+    field(&Level3Header::file_meta_offset, 0x1C),
+    field(&Level3Header::file_meta_length, 0x20),
+    field(&Level3Header::file_data_offset, 0x24));
+static_assert(isValid(LEVEL3_HEADER_LAYOUT));
+
+//The name follows each entry, name_offset is where it went in the arena rather than part of the entry
+constexpr auto DIRECTORY_METADATA_LAYOUT = layout<DirectoryMetadata>(0x18,
+    field(&DirectoryMetadata::parent_offset, 0x00),
+    field(&DirectoryMetadata::sibling_offset, 0x04),
+    field(&DirectoryMetadata::child_offset, 0x08),
+    field(&DirectoryMetadata::first_file_offset, 0x0C),
+    field(&DirectoryMetadata::same_hash_offset, 0x10),
+    field(&DirectoryMetadata::name_length, 0x14));
+static_assert(isValid(DIRECTORY_METADATA_LAYOUT));
+
+constexpr auto FILE_METADATA_LAYOUT = layout<FileMetadata>(0x20,
+    field(&FileMetadata::parent_offset, 0x00),
+    field(&FileMetadata::sibling_offset, 0x04),
+    field(&FileMetadata::data_offset, 0x08),
+    field(&FileMetadata::data_size, 0x10),
+    field(&FileMetadata::same_hash_offset, 0x18),
+    field(&FileMetadata::name_length, 0x1C));
+static_assert(isValid(FILE_METADATA_LAYOUT));
+
+//Offsets of the same hash link and name length within metadata entries, straight from the layouts
+constexpr size_t DIR_SAME_HASH_FIELD = std::get<4>(DIRECTORY_METADATA_LAYOUT.fields).offset;
+constexpr size_t FILE_SAME_HASH_FIELD = std::get<4>(FILE_METADATA_LAYOUT.fields).offset;
+
+//Appends the name that follows a metadata entry to the arena, if it is inside the image
+void appendName(const Image &image, size_t offset, u32 name_length, std::u16string &names) {
+    const size_t count = name_length / 2;
+    if(offset > image.size() || count * 2 > image.size() - offset) {
+        return;
+    }
 
-    scanner.seek(offset);
-    header.header_length = scanner.readInt<u32>();
-    header.dir_hash_offset = scanner.readInt<u32>();
-    header.dir_hash_length = scanner.readInt<u32>();
-    header.dir_meta_offset = scanner.readInt<u32>();
-    header.dir_meta_length = scanner.readInt<u32>();
-    header.file_hash_offset = scanner.readInt<u32>();
-    header.file_hash_length = scanner.readInt<u32>();
-    header.file_meta_offset = scanner.readInt<u32>();
-    header.file_meta_length = scanner.readInt<u32>();
-    header.file_data_offset = scanner.readInt<u32>();
+    const size_t start = names.size();
+    names.resize(start + count);
+    decodeArray(image.data() + offset, names.data() + start, count);
+}
 
-    return header;
+//A table of little-endian u32s that has already been checked to be inside the image
+auto parseHashTable(const u8 *data, u32 length) -> std::vector<u32> {
+    std::vector<u32> table(length / 4);
+    decodeArray(data, table.data(), table.size());
+    return table;
 }
 
-auto parseDirectoryMetadata(const std::vector<u8> &data, size_t offset) -> DirectoryMetadata {
-    Scanner scanner(data);
-    DirectoryMetadata entry;
+//Decodes the metadata entry at entry_offset in a table that has already been checked to be inside
+//the image, and appends its name to the arena. False if the entry or its name runs past the table.
+template<typename Layout, typename Entry>
+auto decodeEntry(const Layout &layout, const u8 *table, size_t table_length, size_t entry_offset, Entry &entry, std::u16string &names) -> bool {
+    if(layout.size > table_length - entry_offset) {
+        return false;
+    }
+
+    decode(layout, table + entry_offset, entry);
+    entry.name_offset = static_cast<u32>(names.size());
+
+    if(entry.name_length > table_length - entry_offset - layout.size) {
+        return false;
+    }
+
+    const size_t count = entry.name_length / 2;
+    names.resize(names.size() + count);
+    decodeArray(table + entry_offset + layout.size, names.data() + entry.name_offset, count);
+    return true;
+}
 
-    scanner.seek(offset);
-    entry.parent_offset = scanner.readInt<u32>();
-    entry.sibling_offset = scanner.readInt<u32>();
-    entry.child_offset = scanner.readInt<u32>();
-    entry.first_file_offset = scanner.readInt<u32>();
-    entry.same_hash_offset = scanner.readInt<u32>();
-    entry.name_length = scanner.readInt<u32>();
+auto nameMatches(const u8 *name, u32 name_length, std::u16string_view other) -> bool {
+    if(name_length != other.size() * 2) {
+        return false;
+    }
 
-    if(entry.name_length > 0) {
-        entry.name.reserve(entry.name_length / 2);
-        
-        for(int i = 0; i < entry.name_length / 2; i++) {
-            entry.name.push_back(scanner.readInt<u16>());
+    for(size_t i = 0; i < other.size(); i++) {
+        if((name[i * 2] | (name[i * 2 + 1] << 8)) != other[i]) {
+            return false;
         }
     }
 
-    return entry;
+    return true;
 }
 
-auto parseFileMetadata(const std::vector<u8> &data, size_t offset) -> FileMetadata {
-    Scanner scanner(data);
-    FileMetadata entry;
+//Walks the hash chain for the bucket of (parent, name) in one of the metadata tables
+auto findEntry(const Image &image, size_t table_offset, size_t table_length, const std::vector<u32> &hash_table, size_t same_hash_field, u32 parent, std::u16string_view name) -> std::optional<u32> {
+    if(hash_table.empty()) {
+        return {};
+    }
 
-    scanner.seek(offset);
-    entry.parent_offset = scanner.readInt<u32>();
-    entry.sibling_offset = scanner.readInt<u32>();
-    entry.data_offset = scanner.readInt<u64>();
-    entry.data_size = scanner.readInt<u64>();
-    entry.same_hash_offset = scanner.readInt<u32>();
-    entry.name_length = scanner.readInt<u32>();
+    u32 entry = hash_table[calcPathHash(parent, name) % hash_table.size()];
+
+    //A chain can't be longer than the number of entries, this guards against loops in bad images
+    for(size_t steps = 0; entry != NO_ENTRY && steps <= table_length / 0x18; steps++) {
+        if(entry + same_hash_field + 8 > table_length) {
+            return {};
+        }
 
-    if(entry.name_length > 0) {
-        entry.name.reserve(entry.name_length / 2);
-        
-        for(int i = 0; i < entry.name_length / 2; i++) {
-            entry.name.push_back(scanner.readInt<u16>());
+        //The name has to fit in the table as well, it's compared straight from the image
+        const u8 *data = image.data() + table_offset + entry;
+        const u32 name_length = loadLittleEndian<u32>(data + same_hash_field + 4);
+        if(name_length > table_length - (entry + same_hash_field + 8)) {
+            return {};
         }
+
+        if(loadLittleEndian<u32>(data) == parent && nameMatches(data + same_hash_field + 8, name_length, name)) {
+            return entry;
+        }
+
+        entry = loadLittleEndian<u32>(data + same_hash_field);
     }
 
+    return {};
+}
+
+//Splits off the next path component, skipping over any repeated separators
+auto nextComponent(std::u16string_view &path) -> std::u16string_view {
+    while(!path.empty() && path.front() == u'/') {
+        path.remove_prefix(1);
+    }
+
+    const size_t end = std::min(path.find(u'/'), path.size());
+    std::u16string_view component = path.substr(0, end);
+    path.remove_prefix(end);
+
+    while(!path.empty() && path.front() == u'/') {
+        path.remove_prefix(1);
+    }
+
+    return component;
+}
+
+} //namespace
+
+
+auto parseLevel3Header(const Image &image, size_t offset) -> Level3Header {
+    Level3Header header{};
+    decode(LEVEL3_HEADER_LAYOUT, image, offset, header);
+    return header;
+}
+
+auto parseDirectoryMetadata(const Image &image, size_t offset, std::u16string &names) -> DirectoryMetadata {
+    DirectoryMetadata entry{};
+    decode(DIRECTORY_METADATA_LAYOUT, image, offset, entry);
+    entry.name_offset = static_cast<u32>(names.size());
+    appendName(image, offset + DIRECTORY_METADATA_LAYOUT.size, entry.name_length, names);
+
     return entry;
 }
 
-auto parseLevel3(const std::vector<u8> &data, size_t offset) -> Level3 {
-    Scanner scanner(data);
+auto parseFileMetadata(const Image &image, size_t offset, std::u16string &names) -> FileMetadata {
+    FileMetadata entry{};
+    decode(FILE_METADATA_LAYOUT, image, offset, entry);
+    entry.name_offset = static_cast<u32>(names.size());
+    appendName(image, offset + FILE_METADATA_LAYOUT.size, entry.name_length, names);
+
+    return entry;
+}
+
+auto checkLevel3Tables(const Image &image, const Region &level, const Level3Header &header) -> Result<void> {
+    const size_t offset = level.offset;
+
+    //Each table is checked once against the level and the image, the entries in them aren't.
+    //Only the metadata has to be in the image, the file data can still be on its way.
+    const struct {
+        const char *name;
+        u32 offset;
+        u32 length;
+    } tables[] = {
+        {"directory hash", header.dir_hash_offset, header.dir_hash_length},
+        {"directory metadata", header.dir_meta_offset, header.dir_meta_length},
+        {"file hash", header.file_hash_offset, header.file_hash_length},
+        {"file metadata", header.file_meta_offset, header.file_meta_length}
+    };
+
+    for(const auto &table : tables) {
+        const Region region{offset + table.offset, table.length};
+        if(!level.contains(region) || !image.contains(region)) {
+            return Error::format("RomFS %s table at 0x%zX (0x%X bytes) is outside level 3!", table.name, region.offset, table.length);
+        }
+    }
+
+    if(header.file_data_offset > level.size) {
+        return Error::format("RomFS file data offset 0x%X is past the end of level 3!", header.file_data_offset);
+    }
+
+    return {};
+}
+
+auto parseLevel3(const Image &image, const Region &level, RomFSTree &tree) -> Result<Level3> {
+    static_assert(sizeof(char16_t) == 2);
     Level3 lvl3;
+    tree = RomFSTree{};
 
-    scanner.seek(offset);
-    lvl3.header = parseLevel3Header(data, offset);
+    const size_t offset = level.offset;
+    if(level.size < LEVEL3_HEADER_LAYOUT.size || !image.contains(Region{offset, LEVEL3_HEADER_LAYOUT.size})) {
+        return Error::format("RomFS level 3 header at 0x%zX is outside the image!", offset);
+    }
+
+    lvl3.offset = offset;
+    lvl3.header = parseLevel3Header(image, offset);
+    const Level3Header &header = lvl3.header;
+
+    const Result<void> tables = checkLevel3Tables(image, level, header);
+    if(!tables) {
+        return tables.error();
+    }
+
+    const u8 *dir_meta = image.data() + offset + header.dir_meta_offset;
+    const u8 *file_meta = image.data() + offset + header.file_meta_offset;
+    const u64 file_data_size = level.size - header.file_data_offset;
+
+    //Entries are at least 0x18/0x20 bytes and names are at most the rest of the table
+    const size_t max_dirs = header.dir_meta_length / 0x18;
+    const size_t max_files = header.file_meta_length / 0x20;
+    lvl3.dir_table.reserve(max_dirs);
+    lvl3.file_table.reserve(max_files);
+    tree.dir_meta_offsets.reserve(max_dirs);
+    tree.dir_parents.reserve(max_dirs);
+    tree.dir_siblings.reserve(max_dirs);
+    tree.dir_children.reserve(max_dirs);
+    tree.dir_files.reserve(max_dirs);
+    tree.dir_names.reserve(max_dirs + 1);
+    tree.file_meta_offsets.reserve(max_files);
+    tree.file_parents.reserve(max_files);
+    tree.file_siblings.reserve(max_files);
+    tree.file_offsets.reserve(max_files);
+    tree.file_sizes.reserve(max_files);
+    tree.file_names.reserve(max_files + 1);
+    tree.names.reserve((header.dir_meta_length + header.file_meta_length) / 2);
+
+    //Entries are 4 byte aligned, so a table indexed by offset / 4 resolves each link in a single lookup
+    std::vector<u32> dir_at(header.dir_meta_length / 4, RomFSTree::NONE);
+    std::vector<u32> file_at(header.file_meta_length / 4, RomFSTree::NONE);
+    auto resolve = [](const std::vector<u32> &at, u32 meta_offset) {
+        return meta_offset % 4 == 0 && meta_offset / 4 < at.size() ? at[meta_offset / 4] : RomFSTree::NONE;
+    };
     
     //Directory Hash Table
-    scanner.seek(offset + lvl3.header.dir_hash_offset);
-    lvl3.dir_hash_table.reserve(lvl3.header.dir_hash_length / 4);
-    for(int i = 0; i < lvl3.header.dir_hash_length / 4; i++) {
-        lvl3.dir_hash_table.push_back(scanner.readInt<u32>());
-    }
-
-    //Directory Metadata Table
-    scanner.seek(offset + lvl3.header.dir_meta_offset);
-    size_t dir_entry_offset = lvl3.header.dir_meta_offset;
-    while(dir_entry_offset < lvl3.header.file_hash_offset - 0x18) {
-        lvl3.dir_table.push_back(parseDirectoryMetadata(data, offset + dir_entry_offset));
-        dir_entry_offset += 0x18 + lvl3.dir_table.back().name_length;
-        
-        //Correct for 4-byte alignment
-        if(dir_entry_offset & 3) {
-            dir_entry_offset += 4 - dir_entry_offset & 3;
+    lvl3.dir_hash_table = parseHashTable(image.data() + offset + header.dir_hash_offset, header.dir_hash_length);
+
+    //Directory Metadata Table, tree links are kept as table offsets until every entry is known
+    size_t dir_entry_offset = 0;
+    while(dir_entry_offset + 0x18 <= header.dir_meta_length) {
+        DirectoryMetadata &entry = lvl3.dir_table.emplace_back();
+        if(!decodeEntry(DIRECTORY_METADATA_LAYOUT, dir_meta, header.dir_meta_length, dir_entry_offset, entry, tree.names)) {
+            return Error::format("RomFS directory entry at 0x%zX runs past the end of its table!", dir_entry_offset);
+        }
+
+        //The root directory has no name, call it RomFS for printing and dumping
+        if(dir_entry_offset == 0 && entry.name_length == 0) {
+            tree.names += u"RomFS";
         }
+
+        dir_at[dir_entry_offset / 4] = tree.dirCount();
+        tree.dir_meta_offsets.push_back(static_cast<u32>(dir_entry_offset));
+        tree.dir_parents.push_back(entry.parent_offset);
+        tree.dir_siblings.push_back(entry.sibling_offset);
+        tree.dir_children.push_back(entry.child_offset);
+        tree.dir_files.push_back(entry.first_file_offset);
+        tree.dir_names.push_back(entry.name_offset);
+
+        //Correct for 4-byte alignment
+        dir_entry_offset += 0x18 + entry.name_length;
+        dir_entry_offset = (dir_entry_offset + 3) & ~size_t(3);
     }
+    tree.dir_names.push_back(static_cast<u32>(tree.names.size()));
 
     //File Hash Table
-    scanner.seek(offset + lvl3.header.file_hash_offset);
-    lvl3.file_hash_table.reserve(lvl3.header.file_hash_length / 4);
-    for(int i = 0; i < lvl3.header.file_hash_length / 4; i++) {
-        lvl3.file_hash_table.push_back(scanner.readInt<u32>());
-    }
+    lvl3.file_hash_table = parseHashTable(image.data() + offset + header.file_hash_offset, header.file_hash_length);
 
     //File Metadata Table
     size_t max_file_addr = 0;
-    size_t file_entry_offset = lvl3.header.file_meta_offset;
-    while(file_entry_offset < lvl3.header.file_data_offset - 0x20) {
-        lvl3.file_table.push_back(parseFileMetadata(data, offset + file_entry_offset));
-        file_entry_offset += 0x20 + lvl3.file_table.back().name_length;
+    size_t file_entry_offset = 0;
+    while(file_entry_offset + 0x20 <= header.file_meta_length) {
+        FileMetadata &entry = lvl3.file_table.emplace_back();
+        if(!decodeEntry(FILE_METADATA_LAYOUT, file_meta, header.file_meta_length, file_entry_offset, entry, tree.names)) {
+            return Error::format("RomFS file entry at 0x%zX runs past the end of its table!", file_entry_offset);
+        }
 
-        //Correct for 4-byte alignment
-        if(file_entry_offset & 3) {
-            file_entry_offset += 4 - file_entry_offset & 3;
+        //Every file has to be inside level 3, so the dumper can read them without checking
+        if(entry.data_size > file_data_size || entry.data_offset > file_data_size - entry.data_size) {
+            return Error::format("RomFS file entry at 0x%zX has its data past the end of level 3!", file_entry_offset);
         }
 
+        file_at[file_entry_offset / 4] = tree.fileCount();
+        tree.file_meta_offsets.push_back(static_cast<u32>(file_entry_offset));
+        tree.file_parents.push_back(entry.parent_offset);
+        tree.file_siblings.push_back(entry.sibling_offset);
+        tree.file_offsets.push_back(entry.data_offset);
+        tree.file_sizes.push_back(entry.data_size);
+        tree.file_names.push_back(entry.name_offset);
+
+        //Correct for 4-byte alignment
+        file_entry_offset += 0x20 + entry.name_length;
+        file_entry_offset = (file_entry_offset + 3) & ~size_t(3);
+
         //Get the max address that is part of a file and use that to determine the size of the file data section
-        max_file_addr = std::max(max_file_addr, lvl3.file_table.back().data_offset + lvl3.file_table.back().data_size);
+        max_file_addr = std::max(max_file_addr, entry.data_offset + entry.data_size);
+    }
+    tree.file_names.push_back(static_cast<u32>(tree.names.size()));
+
+    //Turn the table offsets into tree indices
+    for(u32 i = 0; i < tree.dirCount(); i++) {
+        tree.dir_parents[i] = resolve(dir_at, tree.dir_parents[i]);
+        tree.dir_siblings[i] = resolve(dir_at, tree.dir_siblings[i]);
+        tree.dir_children[i] = resolve(dir_at, tree.dir_children[i]);
+        tree.dir_files[i] = resolve(file_at, tree.dir_files[i]);
     }
 
-    //File Data
-    lvl3.file_data.resize(max_file_addr);
-    if(max_file_addr > 0) {
-        scanner.seek(offset + lvl3.header.file_data_offset);
-        scanner.readBytes(lvl3.file_data.data(), max_file_addr);
+    for(u32 i = 0; i < tree.fileCount(); i++) {
+        tree.file_parents[i] = resolve(dir_at, tree.file_parents[i]);
+        tree.file_siblings[i] = resolve(file_at, tree.file_siblings[i]);
+    }
+
+    const Result<void> checked = checkTree(tree);
+    if(!checked) {
+        return checked.error();
     }
 
+    //File Data
+    lvl3.file_data = Region{offset + header.file_data_offset, max_file_addr};
+
     return lvl3;
 }
 
-auto parseDirectory(const std::vector<u8> &data, size_t dir_offset, size_t file_offset, size_t offset) -> Directory {
-    static_assert(sizeof(char16_t) == 2);
-    DirectoryMetadata entry = parseDirectoryMetadata(data, dir_offset + offset);
-    Directory dir;
-
-    if(!entry.name.empty()) {
-        dir.name = std::u16string(reinterpret_cast<const char16_t*>(entry.name.data()), entry.name.size());
-    } else {
-        dir.name = u"RomFS";
+auto checkTree(const RomFSTree &tree) -> Result<void> {
+    const u32 dir_count = tree.dirCount();
+    const u32 file_count = tree.fileCount();
+    if(dir_count == 0) {
+        return Error{"RomFS has no root directory!"};
     }
-    
-    //Add children directories
-    if(entry.child_offset != 0xFFFFFFFF) {
-        u32 child_offset = dir_offset + entry.child_offset;
-        DirectoryMetadata child_entry = parseDirectoryMetadata(data, child_offset);
-        dir.children.push_back(parseDirectory(data, dir_offset, file_offset, entry.child_offset));
 
-        while(child_entry.sibling_offset != 0xFFFFFFFF) {
-            dir.children.push_back(parseDirectory(data, dir_offset, file_offset, child_entry.sibling_offset));
-            child_offset = dir_offset + child_entry.sibling_offset;
-            child_entry = parseDirectoryMetadata(data, child_offset);
+    //Iterative, a deep tree can't run out of stack
+    std::vector<bool> seen_dirs(dir_count);
+    std::vector<bool> seen_files(file_count);
+    std::vector<u32> pending{0};
+    seen_dirs[0] = true;
+    u32 reached_dirs = 1;
+    u32 reached_files = 0;
+
+    while(!pending.empty()) {
+        const u32 dir = pending.back();
+        pending.pop_back();
+
+        for(u32 child = tree.dir_children[dir]; child != RomFSTree::NONE; child = tree.dir_siblings[child]) {
+            if(child >= dir_count || seen_dirs[child] || tree.dir_parents[child] != dir) {
+                return Error::format("RomFS directory %u is linked into the tree twice or under the wrong parent!", child);
+            }
+
+            seen_dirs[child] = true;
+            reached_dirs++;
+            pending.push_back(child);
         }
-    }
 
-    //Add files
-    if(entry.first_file_offset != 0xFFFFFFFF) {
-        u32 child_file_offset = file_offset + entry.first_file_offset;
-        FileMetadata file_entry = parseFileMetadata(data, child_file_offset);
-        dir.files.emplace_back(File{std::u16string(reinterpret_cast<const char16_t*>(file_entry.name.data()), file_entry.name.size()), file_entry.data_offset, file_entry.data_size});
+        for(u32 file = tree.dir_files[dir]; file != RomFSTree::NONE; file = tree.file_siblings[file]) {
+            if(file >= file_count || seen_files[file] || tree.file_parents[file] != dir) {
+                return Error::format("RomFS file %u is linked into the tree twice or under the wrong parent!", file);
+            }
 
-        while(file_entry.sibling_offset != 0xFFFFFFFF) {
-            child_file_offset = file_offset + file_entry.sibling_offset;
-            file_entry = parseFileMetadata(data, child_file_offset);
-            dir.files.emplace_back(File{std::u16string(reinterpret_cast<const char16_t*>(file_entry.name.data()), file_entry.name.size()), file_entry.data_offset, file_entry.data_size});
+            seen_files[file] = true;
+            reached_files++;
         }
     }
 
-    return dir;
+    if(reached_dirs != dir_count || reached_files != file_count) {
+        return Error::format("RomFS has %u directories and %u files that aren't in the tree!", dir_count - reached_dirs, file_count - reached_files);
+    }
+
+    return {};
+}
+
+auto RomFSTree::dirCount() const -> u32 {
+    return static_cast<u32>(dir_meta_offsets.size());
+}
+
+auto RomFSTree::fileCount() const -> u32 {
+    return static_cast<u32>(file_meta_offsets.size());
+}
+
+auto RomFSTree::dirName(u32 dir) const -> std::u16string_view {
+    return std::u16string_view(names).substr(dir_names[dir], dir_names[dir + 1] - dir_names[dir]);
 }
 
-auto parseRomFSHeader(const std::vector<u8> &data, size_t offset) -> RomFSHeader {
-    Scanner scanner(data);
-    RomFSHeader header;
+auto RomFSTree::fileName(u32 file) const -> std::u16string_view {
+    return std::u16string_view(names).substr(file_names[file], file_names[file + 1] - file_names[file]);
+}
 
-    scanner.seek(offset);
-    header.magic = scanner.readInt<u32>();
-    header.magic_num = scanner.readInt<u32>();
-    header.master_hash_size = scanner.readInt<u32>();
-    header.lvl1_offset = scanner.readInt<u64>();
-    header.lvl1_hash_size = scanner.readInt<u64>();
-    header.lvl1_block_size = scanner.readInt<u32>();
-    scanner.skip(4);
-    header.lvl2_offset = scanner.readInt<u64>();
-    header.lvl2_hash_size = scanner.readInt<u64>();
-    header.lvl2_block_size = scanner.readInt<u32>();
-    scanner.skip(4);
-    header.lvl3_offset = scanner.readInt<u64>();
-    header.lvl3_hash_size = scanner.readInt<u64>();
-    header.lvl3_block_size = scanner.readInt<u32>();
-    scanner.skip(8);
-    header.optional_info_size = scanner.readInt<u32>();
+auto RomFSTree::dirIndex(u32 meta_offset) const -> u32 {
+    auto it = std::lower_bound(dir_meta_offsets.begin(), dir_meta_offsets.end(), meta_offset);
+    return it != dir_meta_offsets.end() && *it == meta_offset ? static_cast<u32>(it - dir_meta_offsets.begin()) : NONE;
+}
+
+auto RomFSTree::fileIndex(u32 meta_offset) const -> u32 {
+    auto it = std::lower_bound(file_meta_offsets.begin(), file_meta_offsets.end(), meta_offset);
+    return it != file_meta_offsets.end() && *it == meta_offset ? static_cast<u32>(it - file_meta_offsets.begin()) : NONE;
+}
 
+auto RomFSTree::filePath(u32 file) const -> std::u16string {
+    std::vector<u32> dirs;
+    u32 dir = file_parents[file];
+
+    //The parent links come from the image, so don't trust them to end at the root
+    while(dir != NONE && dirs.size() < dirCount()) {
+        dirs.push_back(dir);
+        dir = dir == 0 ? NONE : dir_parents[dir];
+    }
+
+    std::u16string path;
+    for(auto it = dirs.rbegin(); it != dirs.rend(); it++) {
+        path += dirName(*it);
+        path += u'/';
+    }
+
+    return path + std::u16string(fileName(file));
+}
+
+auto parseRomFSHeader(const Image &image, size_t offset) -> RomFSHeader {
+    RomFSHeader header{};
+    decode(ROMFS_HEADER_LAYOUT, image, offset, header);
     return header;
 }
 
-auto parseRomFS(const std::vector<u8> &data, size_t offset) -> RomFS {
+auto getIVFCLevels(const RomFSHeader &header, size_t offset, IVFCLevel (&levels)[3]) -> bool {
+    const u32 block_sizes[3] = {header.lvl1_block_size, header.lvl2_block_size, header.lvl3_block_size};
+    const u64 sizes[3] = {header.lvl1_hash_size, header.lvl2_hash_size, header.lvl3_hash_size};
+
+    //The block sizes are stored as log2
+    for(u32 block_size : block_sizes) {
+        if(block_size < 4 || block_size > 30) {
+            return false;
+        }
+    }
+
+    //No real level comes anywhere near this, it keeps the offsets below from overflowing
+    for(u64 size : sizes) {
+        if(size > MAX_LEVEL_SIZE) {
+            return false;
+        }
+    }
+
+    auto align = [](u64 value, u64 alignment) { return (value + alignment - 1) / alignment * alignment; };
+
+    //Stored as level 3, level 1, level 2 after the 0x60 byte header and the master hash
+    u64 position = 0x60 + header.master_hash_size;
+    for(int level : {2, 0, 1}) {
+        const u64 block_size = u64(1) << block_sizes[level];
+        position = align(position, block_size);
+
+        levels[level] = IVFCLevel{Region{offset + position, sizes[level]}, block_size};
+        position += sizes[level];
+    }
+
+    return true;
+}
+
+auto parseRomFS(const Image &image, size_t offset) -> Result<RomFS> {
+    if(!image.contains(Region{offset, ROMFS_HEADER_LAYOUT.size})) {
+        return Error::format("RomFS header at 0x%zX is outside the image!", offset);
+    }
+
     RomFS romfs;
-    romfs.header = parseRomFSHeader(data, offset);
+    romfs.image = &image;
+    romfs.header = parseRomFSHeader(image, offset);
 
     //Check magic 'IVFC'
     if(romfs.header.magic != 0x43465649) {
-        printf("RomFS magic does not match! (Expected: 0x43465649, Actual: %08X)\n", romfs.header.magic);
-        std::exit(-1);
+        return Error::format("RomFS magic does not match! (Expected: 0x43465649, Actual: %08X)", romfs.header.magic);
     }
 
     //Check magic number 0x10000
     if(romfs.header.magic_num != 0x10000) {
-        printf("RomFS magic number does not match! (Expected: 0x10000, Actual: %08X)\n", romfs.header.magic_num);
-        std::exit(-1);
+        return Error::format("RomFS magic number does not match! (Expected: 0x10000, Actual: %08X)", romfs.header.magic_num);
     }
 
-    size_t lvl3_offset = offset + 0x1000;
-    romfs.level3 = parseLevel3(data, offset + 0x1000);
-    romfs.root = parseDirectory(data, lvl3_offset + romfs.level3.header.dir_meta_offset, lvl3_offset + romfs.level3.header.file_meta_offset, 0);
+    if(!getIVFCLevels(romfs.header, offset, romfs.levels)) {
+        return Error::format("RomFS IVFC levels are invalid! (Block sizes: %u, %u, %u)",
+            romfs.header.lvl1_block_size, romfs.header.lvl2_block_size, romfs.header.lvl3_block_size);
+    }
+
+    romfs.offset = offset;
+    Result<Level3> level3 = parseLevel3(image, romfs.levels[2].data, romfs.tree);
+    if(!level3) {
+        return level3.error();
+    }
+    romfs.level3 = std::move(level3.value());
+
+    //The metadata has all been copied into the tables and the tree
+    if(romfs.level3.file_data.offset > romfs.level3.offset) {
+        image.release(romfs.level3.offset, romfs.level3.file_data.offset - romfs.level3.offset);
+    }
 
     return romfs;
+}
+
+auto calcPathHash(u32 parent_offset, std::u16string_view name) -> u32 {
+    u32 hash = parent_offset ^ 123456789;
+
+    for(const char16_t c : name) {
+        hash = (hash >> 5) | (hash << 27);
+        hash ^= c;
+    }
+
+    return hash;
+}
+
+auto lookupDirectory(const RomFS &romfs, std::u16string_view path) -> std::optional<u32> {
+    const Level3 &lvl3 = romfs.level3;
+    const size_t table_offset = lvl3.offset + lvl3.header.dir_meta_offset;
+    u32 dir = 0; //The root directory is always the first entry
+
+    for(std::u16string_view name = nextComponent(path); !name.empty(); name = nextComponent(path)) {
+        std::optional<u32> child = findEntry(*romfs.image, table_offset, lvl3.header.dir_meta_length, lvl3.dir_hash_table, DIR_SAME_HASH_FIELD, dir, name);
+        if(!child.has_value()) {
+            return {};
+        }
+
+        dir = child.value();
+    }
+
+    const u32 index = romfs.tree.dirIndex(dir);
+    return index != RomFSTree::NONE ? std::optional<u32>(index) : std::nullopt;
+}
+
+auto lookupFile(const RomFS &romfs, std::u16string_view path) -> std::optional<u32> {
+    const size_t separator = path.find_last_of(u'/');
+    const std::u16string_view name = separator == std::u16string_view::npos ? path : path.substr(separator + 1);
+    const std::u16string_view parent_path = separator == std::u16string_view::npos ? std::u16string_view() : path.substr(0, separator);
+
+    std::optional<u32> parent = lookupDirectory(romfs, parent_path);
+    if(!parent.has_value() || name.empty()) {
+        return {};
+    }
+
+    //Hash chains link metadata offsets, not tree indices
+    const Level3 &lvl3 = romfs.level3;
+    const u32 parent_offset = romfs.tree.dir_meta_offsets[parent.value()];
+    std::optional<u32> file = findEntry(*romfs.image, lvl3.offset + lvl3.header.file_meta_offset, lvl3.header.file_meta_length, lvl3.file_hash_table, FILE_SAME_HASH_FIELD, parent_offset, name);
+    if(!file.has_value()) {
+        return {};
+    }
+
+    const u32 index = romfs.tree.fileIndex(file.value());
+    return index != RomFSTree::NONE ? std::optional<u32>(index) : std::nullopt;
+}
+
+auto decodeUtf8(std::string_view text) -> std::optional<std::u16string> {
+    std::u16string out;
+
+    for(size_t i = 0; i < text.size();) {
+        const u8 lead = text[i];
+        const size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+        if(length == 0 || length > text.size() - i) {
+            return std::nullopt;
+        }
+
+        u32 code_point = length == 1 ? lead : lead & (0x7F >> length);
+        for(size_t j = 1; j < length; j++) {
+            if((text[i + j] & 0xC0) != 0x80) {
+                return std::nullopt;
+            }
+            code_point = (code_point << 6) | (text[i + j] & 0x3F);
+        }
+        i += length;
+
+        if(code_point >= 0x10000) {
+            code_point -= 0x10000;
+            out += static_cast<char16_t>(0xD800 + (code_point >> 10));
+            out += static_cast<char16_t>(0xDC00 + (code_point & 0x3FF));
+        } else {
+            out += static_cast<char16_t>(code_point);
+        }
+    }
+
+    return out;
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "Types.hpp"
+#include "Image.hpp"
+#include "Result.hpp"
+#include <optional>
 #include <vector>
 #include <string>
+#include <string_view>
 
 
 struct RomFSHeader {
@@ -47,7 +51,7 @@ struct DirectoryMetadata {
     u32 first_file_offset;
     u32 same_hash_offset;
     u32 name_length;
-    std::vector<u16> name; //In units of 16-bits (seems to be UTF-16 or UCS-2)
+    u32 name_offset; //Start of the name in the name arena it was parsed into
 };
 
 struct FileMetadata {
@@ -57,40 +61,95 @@ struct FileMetadata {
     u64 data_size;
     u32 same_hash_offset;
     u32 name_length;
-    std::vector<u16> name; //In units of 16-bits (seems to be UTF-16 or UCS-2)
+    u32 name_offset; //Start of the name in the name arena it was parsed into
 };
 
 struct Level3 {
+    size_t offset; //Absolute offset in the image, the header offsets are relative to this
     Level3Header header;
     std::vector<u32> dir_hash_table;
     std::vector<DirectoryMetadata> dir_table;
     std::vector<u32> file_hash_table;
     std::vector<FileMetadata> file_table;
-    std::vector<u8> file_data;
+    Region file_data;
 };
 
-struct File {
-    std::u16string name;
-    size_t offset;
-    size_t size;
+//The directory tree as flat tables of directories and files linked by index,
+//with every name stored in a single arena. Entries are in metadata table order,
+//so directory 0 is the root and the metadata offsets are ascending.
+struct RomFSTree {
+    static constexpr u32 NONE = 0xFFFFFFFF;
+
+    std::vector<u32> dir_meta_offsets;
+    std::vector<u32> dir_parents;
+    std::vector<u32> dir_siblings;
+    std::vector<u32> dir_children; //First child directory
+    std::vector<u32> dir_files;    //First file
+    std::vector<u32> dir_names;    //Start of each name in the arena, plus one past the last name
+
+    std::vector<u32> file_meta_offsets;
+    std::vector<u32> file_parents;
+    std::vector<u32> file_siblings;
+    std::vector<u64> file_offsets; //Relative to the start of the file data
+    std::vector<u64> file_sizes;
+    std::vector<u32> file_names;   //Start of each name in the arena, plus one past the last name
+
+    std::u16string names;
+
+    auto dirCount() const -> u32;
+    auto fileCount() const -> u32;
+    auto dirName(u32 dir) const -> std::u16string_view;
+    auto fileName(u32 file) const -> std::u16string_view;
+
+    //Metadata table offset to index, NONE if there is no entry at that offset
+    auto dirIndex(u32 meta_offset) const -> u32;
+    auto fileIndex(u32 meta_offset) const -> u32;
+
+    //Full path of a file starting with the root's name, e.g. "RomFS/dir/file"
+    auto filePath(u32 file) const -> std::u16string;
 };
 
-struct Directory {
-    std::u16string name;
-    std::vector<Directory> children;
-    std::vector<File> files;
+//A level of the IVFC hash tree as it is stored in the image. After the header and
+//master hash come level 3, level 1 and level 2, each aligned to its own block size.
+struct IVFCLevel {
+    Region data;
+    size_t block_size;
 };
 
 struct RomFS {
+    const Image *image;
+    size_t offset;
     RomFSHeader header;
+    IVFCLevel levels[3]; //Levels 1 to 3, the hashes of each level's blocks are stored in the previous one
     Level3 level3;
-    Directory root;
+    RomFSTree tree;
 };
 
-auto parseLevel3Header(const std::vector<u8> &data, size_t offset) -> Level3Header;
-auto parseDirectoryMetadata(const std::vector<u8> &data, size_t offest) -> DirectoryMetadata;
-auto parseFileMetadata(const std::vector<u8> &data, size_t offset) -> FileMetadata;
-auto parseLevel3(const std::vector<u8> &data, size_t offset) -> Level3;
-auto parseDirectory(const std::vector<u8> &data, size_t dir_offset, size_t file_offset, size_t offset) -> Directory;
-auto parseRomFSHeader(const std::vector<u8> &data, size_t offset) -> RomFSHeader;
-auto parseRomFS(const std::vector<u8> &data, size_t offset) -> RomFS;
\ No newline at end of file
+auto parseLevel3Header(const Image &image, size_t offset) -> Level3Header;
+//Names are appended to the arena, in units of 16-bits (seems to be UTF-16 or UCS-2)
+auto parseDirectoryMetadata(const Image &image, size_t offset, std::u16string &names) -> DirectoryMetadata;
+auto parseFileMetadata(const Image &image, size_t offset, std::u16string &names) -> FileMetadata;
+
+//The four metadata tables have to be inside both the level and the image, and the file data inside the level
+auto checkLevel3Tables(const Image &image, const Region &level, const Level3Header &header) -> Result<void>;
+//Decodes each metadata record exactly once, filling in both the level 3 tables
+//and the tree. Table entry i is directory/file i of the tree and shares its name.
+//The header and tables have to be inside both the level and the image, and every
+//file inside the level. The file data itself doesn't have to be in the image yet.
+auto parseLevel3(const Image &image, const Region &level, RomFSTree &tree) -> Result<Level3>;
+//Checks that the links form a single tree under the root: every directory and file is reached
+//from it exactly once, through the parent it names. Whatever walks the tree relies on this,
+//a bad image could otherwise link a directory back into itself.
+auto checkTree(const RomFSTree &tree) -> Result<void>;
+auto parseRomFSHeader(const Image &image, size_t offset) -> RomFSHeader;
+auto getIVFCLevels(const RomFSHeader &header, size_t offset, IVFCLevel (&levels)[3]) -> bool;
+auto parseRomFS(const Image &image, size_t offset) -> Result<RomFS>;
+
+//Path lookups through the RomFS hash tables, these only touch the entries along
+//the path. Paths are relative to the RomFS root and separated by '/', the result
+//is the index of the directory or file in the tree.
+auto calcPathHash(u32 parent_offset, std::u16string_view name) -> u32;
+auto lookupDirectory(const RomFS &romfs, std::u16string_view path) -> std::optional<u32>;
+auto lookupFile(const RomFS &romfs, std::u16string_view path) -> std::optional<u32>;
+//UTF-8 to the UTF-16 that RomFS names are stored in, empty if the text isn't valid UTF-8
+auto decodeUtf8(std::string_view text) -> std::optional<std::u16string>;
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "RomFSIndex.hpp"
+#include "Sha256.hpp"
+#include <cstring>
+#include <fstream>
+
+
+namespace {
+
+constexpr u8 INDEX_MAGIC[4] = {'R', 'F', 'S', 'I'};
+//Bump whenever the layout below or any of the structs written as-is change
+constexpr u32 INDEX_VERSION = 1;
+
+//The metadata tables are written as-is, so pin their layout
+static_assert(sizeof(Level3Header) == 0x28);
+static_assert(sizeof(DirectoryMetadata) == 0x1C);
+static_assert(sizeof(FileMetadata) == 0x28);
+
+struct IndexHeader {
+    u8 magic[4];
+    u32 version;
+    u64 image_size;
+    s64 image_mtime;
+    u64 romfs_offset;
+    u8 romfs_hash[32];
+    u64 file_data_size;
+    u32 dir_count;
+    u32 file_count;
+    u32 dir_hash_count;
+    u32 file_hash_count;
+    u32 names_length;
+    u32 reserved;
+};
+
+//Hash of the IVFC header and master hash, which transitively covers the whole RomFS
+auto romfsHash(const Image &image, size_t offset) -> std::optional<Sha256Hash> {
+    if(offset > image.size() || image.size() - offset < 0x60) {
+        return {};
+    }
+
+    const RomFSHeader header = parseRomFSHeader(image, offset);
+    if(image.size() - offset < 0x60 + u64(header.master_hash_size)) {
+        return {};
+    }
+
+    return sha256(image.data() + offset, 0x60 + header.master_hash_size);
+}
+
+//Every array starts 8 byte aligned so the file could be used straight from a mapping
+class IndexWriter {
+public:
+
+    template<typename T>
+    void write(const T *data, size_t count) {
+        const u8 *bytes = reinterpret_cast<const u8*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+        buffer.resize((buffer.size() + 7) & ~size_t(7), 0);
+    }
+
+    template<typename T>
+    void write(const std::vector<T> &values) {
+        write(values.data(), values.size());
+    }
+
+    std::vector<u8> buffer;
+};
+
+class IndexReader {
+public:
+
+    IndexReader(const u8 *data, size_t size) : data(data), size(size), position(0) {}
+
+    template<typename T>
+    auto read(T *out, size_t count) -> bool {
+        if(count > (size - position) / sizeof(T)) {
+            return false;
+        }
+
+        std::memcpy(out, data + position, count * sizeof(T));
+        position = std::min(size, (position + count * sizeof(T) + 7) & ~size_t(7));
+        return true;
+    }
+
+    //Any vector or string, the count is checked before anything is allocated for it
+    template<typename Container>
+    auto read(Container &out, size_t count) -> bool {
+        if(count > (size - position) / sizeof(typename Container::value_type)) {
+            return false;
+        }
+
+        out.resize(count);
+        return read(out.data(), count);
+    }
+
+private:
+
+    const u8 *data;
+    size_t size;
+    size_t position;
+};
+
+} //namespace
+
+auto loadRomFSIndex(const std::string &path, const Image &image, size_t offset, const RomFSIndexKey &key) -> std::optional<RomFS> {
+    const std::optional<Image> file = Image::open(path);
+    if(!file.has_value()) {
+        return {};
+    }
+
+    IndexReader reader(file->data(), file->size());
+    IndexHeader header;
+    if(!reader.read(&header, 1)) {
+        return {};
+    }
+
+    if(std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.version != INDEX_VERSION
+        || header.image_size != key.image_size || header.image_mtime != key.image_mtime || header.romfs_offset != offset) {
+        return {};
+    }
+
+    const std::optional<Sha256Hash> hash = romfsHash(image, offset);
+    if(!hash.has_value() || std::memcmp(hash->data(), header.romfs_hash, sizeof(header.romfs_hash)) != 0) {
+        return {};
+    }
+
+    RomFS romfs;
+    romfs.image = &image;
+    romfs.offset = offset;
+    romfs.header = parseRomFSHeader(image, offset);
+    if(!getIVFCLevels(romfs.header, offset, romfs.levels)) {
+        return {};
+    }
+
+    Level3 &lvl3 = romfs.level3;
+    RomFSTree &tree = romfs.tree;
+    lvl3.offset = romfs.levels[2].data.offset;
+
+    const bool complete = reader.read(&lvl3.header, 1)
+        && reader.read(lvl3.dir_hash_table, header.dir_hash_count)
+        && reader.read(lvl3.file_hash_table, header.file_hash_count)
+        && reader.read(lvl3.dir_table, header.dir_count)
+        && reader.read(lvl3.file_table, header.file_count)
+        && reader.read(tree.dir_meta_offsets, header.dir_count)
+        && reader.read(tree.dir_parents, header.dir_count)
+        && reader.read(tree.dir_siblings, header.dir_count)
+        && reader.read(tree.dir_children, header.dir_count)
+        && reader.read(tree.dir_files, header.dir_count)
+        && reader.read(tree.dir_names, u64(header.dir_count) + 1)
+        && reader.read(tree.file_meta_offsets, header.file_count)
+        && reader.read(tree.file_parents, header.file_count)
+        && reader.read(tree.file_siblings, header.file_count)
+        && reader.read(tree.file_offsets, header.file_count)
+        && reader.read(tree.file_sizes, header.file_count)
+        && reader.read(tree.file_names, u64(header.file_count) + 1)
+        && reader.read(tree.names, header.names_length);
+
+    if(!complete) {
+        return {};
+    }
+
+    //Names are looked up by these, so make sure they stay inside the arena
+    for(const auto *starts : {&tree.dir_names, &tree.file_names}) {
+        for(size_t i = 0; i + 1 < starts->size(); i++) {
+            if((*starts)[i] > (*starts)[i + 1] || (*starts)[i + 1] > tree.names.size()) {
+                return {};
+            }
+        }
+    }
+
+    //The rest of the tool trusts a loaded index as much as a parsed level 3, so hold it to the same checks
+    const Region &level = romfs.levels[2].data;
+    if(level.size < sizeof(Level3Header) || !image.contains(Region{level.offset, sizeof(Level3Header)})) {
+        return {};
+    }
+
+    const Level3Header image_header = parseLevel3Header(image, level.offset);
+    if(std::memcmp(&image_header, &lvl3.header, sizeof(Level3Header)) != 0
+        || !checkLevel3Tables(image, level, lvl3.header) || !checkTree(tree)) {
+        return {};
+    }
+
+    if(header.file_data_size > level.size - lvl3.header.file_data_offset) {
+        return {};
+    }
+
+    for(u32 i = 0; i < tree.fileCount(); i++) {
+        if(tree.file_sizes[i] > header.file_data_size || tree.file_offsets[i] > header.file_data_size - tree.file_sizes[i]) {
+            return {};
+        }
+    }
+
+    lvl3.file_data = Region{lvl3.offset + lvl3.header.file_data_offset, header.file_data_size};
+    return romfs;
+}
+
+auto saveRomFSIndex(const std::string &path, const RomFS &romfs, const RomFSIndexKey &key) -> bool {
+    const std::optional<Sha256Hash> hash = romfsHash(*romfs.image, romfs.offset);
+    if(!hash.has_value()) {
+        return false;
+    }
+
+    const Level3 &lvl3 = romfs.level3;
+    const RomFSTree &tree = romfs.tree;
+
+    IndexHeader header{};
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.image_size = key.image_size;
+    header.image_mtime = key.image_mtime;
+    header.romfs_offset = romfs.offset;
+    std::memcpy(header.romfs_hash, hash->data(), hash->size());
+    header.file_data_size = lvl3.file_data.size;
+    header.dir_count = tree.dirCount();
+    header.file_count = tree.fileCount();
+    header.dir_hash_count = static_cast<u32>(lvl3.dir_hash_table.size());
+    header.file_hash_count = static_cast<u32>(lvl3.file_hash_table.size());
+    header.names_length = static_cast<u32>(tree.names.size());
+
+    IndexWriter writer;
+    writer.write(&header, 1);
+    writer.write(&lvl3.header, 1);
+    writer.write(lvl3.dir_hash_table);
+    writer.write(lvl3.file_hash_table);
+    writer.write(lvl3.dir_table);
+    writer.write(lvl3.file_table);
+    writer.write(tree.dir_meta_offsets);
+    writer.write(tree.dir_parents);
+    writer.write(tree.dir_siblings);
+    writer.write(tree.dir_children);
+    writer.write(tree.dir_files);
+    writer.write(tree.dir_names);
+    writer.write(tree.file_meta_offsets);
+    writer.write(tree.file_parents);
+    writer.write(tree.file_siblings);
+    writer.write(tree.file_offsets);
+    writer.write(tree.file_sizes);
+    writer.write(tree.file_names);
+    writer.write(tree.names.data(), tree.names.size());
+
+    //Written under a temporary name first so a reader never sees half an index
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file_stream(temp_path, std::ios::binary | std::ios::trunc);
+        if(!file_stream.is_open() || !file_stream.write(reinterpret_cast<const char*>(writer.buffer.data()), writer.buffer.size())) {
+            return false;
+        }
+    }
+
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "RomFS.hpp"
+#include <optional>
+#include <string>
+
+
+//What a sidecar index has to match, besides the RomFS itself, to be used for an image
+struct RomFSIndexKey {
+    u64 image_size;
+    s64 image_mtime;
+};
+
+//A sidecar index is a parsed RomFS saved as flat arrays in the tool's native layout:
+//the level 3 header and hash tables, the metadata tables, the tree and the name arena.
+//Loading it is a handful of copies instead of decoding every metadata record.
+//The index is only used if the key, the RomFS offset and the hash of the IVFC header
+//and master hash all match, otherwise loading returns nullopt.
+auto loadRomFSIndex(const std::string &path, const Image &image, size_t offset, const RomFSIndexKey &key) -> std::optional<RomFS>;
+auto saveRomFSIndex(const std::string &path, const RomFS &romfs, const RomFSIndexKey &key) -> bool;
\ No newline at end of file
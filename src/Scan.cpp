@@ -0,0 +1,347 @@
+#include "Scan.hpp"
+#include "NCSD.hpp"
+#include <fmt/format.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+namespace {
+
+//Files handed to each task at once
+constexpr size_t SCAN_BATCH = 32;
+
+struct ScanFile {
+    std::string path;
+    u64 size;
+    long long mtime; //Nanoseconds since the Unix epoch, except on Windows
+    std::string entry; //The image's line in the catalog, empty if it isn't an NCSD or NCCH
+};
+
+//Reads with positioned reads where possible, so there is no seeking and only the requested bytes are read
+class InputFile {
+public:
+
+    explicit InputFile(const std::string &path) {
+#ifdef _WIN32
+        stream.open(path, std::ios::binary);
+#else
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+
+    ~InputFile() {
+#ifndef _WIN32
+        if(fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    InputFile(const InputFile&) = delete;
+    auto operator=(const InputFile&) -> InputFile& = delete;
+
+    auto isOpen() const -> bool {
+#ifdef _WIN32
+        return stream.is_open();
+#else
+        return fd >= 0;
+#endif
+    }
+
+    //Anything past the end of the file is left zeroed
+    auto read(u64 offset, size_t size) -> std::vector<u8> {
+        std::vector<u8> bytes(size, 0);
+#ifdef _WIN32
+        stream.clear();
+        stream.seekg(offset);
+        stream.read(reinterpret_cast<char*>(bytes.data()), size);
+#else
+        size_t done = 0;
+        while(done < size) {
+            const ssize_t count = pread(fd, bytes.data() + done, size - done, static_cast<off_t>(offset + done));
+            if(count <= 0) {
+                break;
+            }
+            done += count;
+        }
+#endif
+        return bytes;
+    }
+
+private:
+
+#ifdef _WIN32
+    std::ifstream stream;
+#else
+    int fd;
+#endif
+};
+
+void appendJsonString(std::string &out, std::string_view str) {
+    out += '"';
+    for(char c : str) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if(static_cast<u8>(c) < 0x20) {
+            out += fmt::format("\\u{:04x}", static_cast<u8>(c));
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+//Fixed size, NUL padded strings from the headers
+auto headerString(const u8 *data, size_t size) -> std::string {
+    const u8 *end = std::find(data, data + size, 0);
+    return std::string(reinterpret_cast<const char*>(data), end - data);
+}
+
+//Reads the ExHeader's title if it can be decrypted, returns false if it can't
+auto readTitle(InputFile &file, u64 offset, const NCCHHeader &header, const KeyFile *keys, std::string &title) -> bool {
+    std::vector<u8> exheader = file.read(offset + 0x200, 0x200);
+
+    if(isNCCHEncrypted(header)) {
+        if(keys == nullptr) {
+            return false;
+        }
+
+        const Result<NCCHKeys> ncch_keys = getNCCHKeys(header, keys);
+        if(!ncch_keys) {
+            printf("Error: %s\n", ncch_keys.error().message.c_str());
+            return false;
+        }
+
+        AESCTR(ncch_keys.value().primary).crypt(getNCCHCounter(header, EXHEADER_SECTION, 0x200), 0, exheader.data(), exheader.size());
+    }
+
+    const Image image = Image::fromMemory(std::move(exheader));
+    const SystemControlInfo sci = parseSystemControlInfo(image, 0);
+    title = headerString(sci.app_title, sizeof(SystemControlInfo::app_title));
+    return true;
+}
+
+//Appends a partition's object, or nothing if there isn't an NCCH there
+void appendPartition(std::string &out, InputFile &file, int index, u64 offset, u64 size, const KeyFile *keys) {
+    const Image image = Image::fromMemory(file.read(offset, 0x200));
+    const NCCHHeader header = parseNCCHHeader(image, 0);
+
+    if(header.magic != 0x4843434E) {
+        return;
+    }
+
+    if(out.back() != '[') {
+        out += ',';
+    }
+
+    out += fmt::format("{{\"index\":{},\"offset\":{},\"size\":{},\"program_id\":\"{:016X}\",\"product_code\":", index, offset, size, header.program_id);
+    appendJsonString(out, headerString(header.product_code, sizeof(NCCHHeader::product_code)));
+
+    std::string title;
+    out += ",\"title\":";
+    if(header.exheader_size > 0 && readTitle(file, offset, header, keys, title)) {
+        appendJsonString(out, title);
+    } else {
+        out += "null";
+    }
+
+    out += fmt::format(",\"encrypted\":{}}}", isNCCHEncrypted(header) ? "true" : "false");
+}
+
+void scanFile(ScanFile &scan, const KeyFile *keys) {
+    InputFile file(scan.path);
+    if(!file.isOpen() || scan.size < 0x200) {
+        return;
+    }
+
+    const Image image = Image::fromMemory(file.read(0, 0x200));
+    const u32 magic = parseNCSDHeader(image, 0).magic;
+
+    std::string entry = "{\"path\":";
+    appendJsonString(entry, scan.path);
+    entry += fmt::format(",\"size\":{},\"mtime\":{}", scan.size, scan.mtime);
+
+    if(magic == 0x4453434E) {
+        const NCSDHeader header = parseNCSDHeader(image, 0);
+        entry += fmt::format(",\"type\":\"NCSD\",\"media_id\":\"{:016X}\",\"partitions\":[", header.media_id);
+
+        for(int i = 0; i < 8; i++) {
+            if(header.partition_table[i][1] > 0) {
+                appendPartition(entry, file, i, u64(header.partition_table[i][0]) * 0x200, u64(header.partition_table[i][1]) * 0x200, keys);
+            }
+        }
+    } else if(magic == 0x4843434E) {
+        entry += ",\"type\":\"NCCH\",\"partitions\":[";
+        appendPartition(entry, file, 0, 0, scan.size, keys);
+    } else {
+        return;
+    }
+
+    scan.entry = entry + "]}";
+}
+
+//Reads the leading "path", "size" and "mtime" fields of a catalog line
+auto parseEntryKey(const std::string &line, std::string &path, u64 &size, long long &mtime) -> bool {
+    const std::string prefix = "{\"path\":\"";
+    if(line.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+
+    size_t i = prefix.size();
+    for(; i < line.size() && line[i] != '"'; i++) {
+        if(line[i] != '\\') {
+            path += line[i];
+        } else if(i + 1 < line.size() && line[i + 1] == 'u') {
+            path += static_cast<char>(std::stoi(line.substr(i + 2, 4), nullptr, 16));
+            i += 5;
+        } else if(i + 1 < line.size()) {
+            path += line[++i];
+        }
+    }
+
+    return std::sscanf(line.c_str() + std::min(i, line.size()), "\",\"size\":%llu,\"mtime\":%lld", reinterpret_cast<unsigned long long*>(&size), &mtime) == 2;
+}
+
+auto loadCatalog(const std::string &catalog_path) -> std::unordered_map<std::string, ScanFile> {
+    std::unordered_map<std::string, ScanFile> entries;
+    std::ifstream catalog(catalog_path);
+    std::string line;
+
+    while(std::getline(catalog, line)) {
+        if(!line.empty() && line.back() == ',') {
+            line.pop_back();
+        }
+
+        ScanFile scan{};
+        try {
+            if(parseEntryKey(line, scan.path, scan.size, scan.mtime)) {
+                scan.entry = line;
+                entries[scan.path] = std::move(scan);
+            }
+        } catch(const std::exception &e) {
+            //A damaged line just means that image is read again
+        }
+    }
+
+    return entries;
+}
+
+void addFile(std::vector<ScanFile> &files, const std::filesystem::path &path) {
+    const std::string normal_path = path.lexically_normal().string();
+
+#ifdef _WIN32
+    std::error_code error;
+    const u64 size = std::filesystem::file_size(path, error);
+    const auto mtime = std::filesystem::last_write_time(path, error);
+
+    if(!error) {
+        files.push_back(ScanFile{normal_path, size, static_cast<long long>(mtime.time_since_epoch().count()), {}});
+    }
+#else
+    struct stat info;
+    if(stat(normal_path.c_str(), &info) == 0) {
+        const long long mtime = static_cast<long long>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        files.push_back(ScanFile{normal_path, static_cast<u64>(info.st_size), mtime, {}});
+    }
+#endif
+}
+
+} //namespace
+
+auto scanImages(const std::vector<std::string> &paths, const std::string &catalog_path, const KeyFile *keys, ThreadPool *pool) -> bool {
+    std::vector<ScanFile> files;
+
+    for(const auto &path : paths) {
+        std::error_code error;
+        if(std::filesystem::is_directory(path, error)) {
+            auto options = std::filesystem::directory_options::skip_permission_denied;
+            for(auto it = std::filesystem::recursive_directory_iterator(path, options, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+                if(it->is_regular_file(error)) {
+                    addFile(files, it->path());
+                }
+            }
+        } else if(std::filesystem::is_regular_file(path, error)) {
+            addFile(files, path);
+        } else {
+            printf("Warning: '%s' is not a file or directory\n", path.c_str());
+        }
+    }
+
+    std::sort(files.begin(), files.end(), [](const ScanFile &a, const ScanFile &b) { return a.path < b.path; });
+    files.erase(std::unique(files.begin(), files.end(), [](const ScanFile &a, const ScanFile &b) { return a.path == b.path; }), files.end());
+
+    //Only files that changed since the last scan are read
+    const std::unordered_map<std::string, ScanFile> previous = loadCatalog(catalog_path);
+    std::vector<ScanFile*> changed;
+
+    for(auto &file : files) {
+        auto it = previous.find(file.path);
+        if(it != previous.end() && it->second.size == file.size && it->second.mtime == file.mtime) {
+            file.entry = it->second.entry;
+        } else {
+            changed.push_back(&file);
+        }
+    }
+
+    TaskGroup group;
+    for(size_t start = 0; start < changed.size(); start += SCAN_BATCH) {
+        auto scan = [&changed, start, keys] {
+            for(size_t i = start; i < std::min(start + SCAN_BATCH, changed.size()); i++) {
+                scanFile(*changed[i], keys);
+            }
+        };
+
+        if(pool != nullptr) {
+            pool->submit(scan, group);
+        } else {
+            scan();
+        }
+    }
+
+    if(pool != nullptr) {
+        group.wait();
+    }
+
+    //Written next to the old catalog first so an interrupted scan doesn't lose it
+    const std::string temp_path = catalog_path + ".tmp";
+    size_t image_count = 0;
+    {
+        std::ofstream catalog(temp_path, std::ios::trunc);
+        if(!catalog.is_open()) {
+            printf("Error: Failed to write catalog '%s'!\n", catalog_path.c_str());
+            return false;
+        }
+
+        catalog << "[\n";
+        for(const auto &file : files) {
+            if(!file.entry.empty()) {
+                catalog << (image_count++ > 0 ? ",\n" : "") << file.entry;
+            }
+        }
+        catalog << "\n]\n";
+
+        if(!catalog.good()) {
+            printf("Error: Failed to write catalog '%s'!\n", catalog_path.c_str());
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, catalog_path, error);
+    if(error) {
+        printf("Error: Failed to write catalog '%s'!\n", catalog_path.c_str());
+        return false;
+    }
+
+    printf("Catalogued %zu images, %zu files read and %zu unchanged\n", image_count, changed.size(), files.size() - changed.size());
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Crypto.hpp"
+#include "ThreadPool.hpp"
+#include <string>
+#include <vector>
+
+
+//Catalogues images by reading only their headers: the NCSD header, plus the NCCH header
+//and the start of the ExHeader of each partition, a few KB per image. Directories are
+//searched recursively. The catalog is a JSON array with one image per line, entries of an
+//existing catalog are reused for files whose size and modification time haven't changed.
+auto scanImages(const std::vector<std::string> &paths, const std::string &catalog_path, const KeyFile *keys, ThreadPool *pool) -> bool;
\ No newline at end of file
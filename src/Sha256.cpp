@@ -0,0 +1,369 @@
+#include "Sha256.hpp"
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    #define SHA256_X86
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+
+namespace {
+
+constexpr u32 K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+constexpr u32 INITIAL_STATE[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+using CompressFunc = void (*)(u32 state[8], const u8 *data, size_t blocks);
+
+auto loadBE32(const u8 *data) -> u32 {
+    return (static_cast<u32>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+auto rotr(u32 value, int count) -> u32 {
+    return (value >> count) | (value << (32 - count));
+}
+
+void compressScalar(u32 state[8], const u8 *data, size_t blocks) {
+    u32 w[64];
+
+    while(blocks-- > 0) {
+        for(int t = 0; t < 16; t++) {
+            w[t] = loadBE32(data + t * 4);
+        }
+
+        for(int t = 16; t < 64; t++) {
+            const u32 s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            const u32 s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        u32 a = state[0], b = state[1], c = state[2], d = state[3];
+        u32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for(int t = 0; t < 64; t++) {
+            const u32 t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+            const u32 t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef SHA256_X86
+
+__attribute__((target("sha,sse4.1")))
+void compressShaNi(u32 state[8], const u8 *data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+
+    //The instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while(blocks-- > 0) {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i w[4];
+
+        //Four rounds per iteration, the message schedule is kept as a rolling window of four vectors
+        for(int i = 0; i < 16; i++) {
+            if(i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16)), byte_swap);
+            } else {
+                __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+            }
+
+            __m128i message = _mm_add_epi32(w[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[i * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            message = _mm_shuffle_epi32(message, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+__attribute__((target("avx2")))
+inline auto rotr8(__m256i value, int count) -> __m256i {
+    return _mm256_or_si256(_mm256_srli_epi32(value, count), _mm256_slli_epi32(value, 32 - count));
+}
+
+//One block for each of 8 independent messages, state is stored as [word][lane]
+__attribute__((target("avx2")))
+void compressAvx2(u32 state[8][8], const u8 *const blocks[8]) {
+    __m256i w[16];
+    for(int t = 0; t < 16; t++) {
+        w[t] = _mm256_setr_epi32(
+            loadBE32(blocks[0] + t * 4), loadBE32(blocks[1] + t * 4), loadBE32(blocks[2] + t * 4), loadBE32(blocks[3] + t * 4),
+            loadBE32(blocks[4] + t * 4), loadBE32(blocks[5] + t * 4), loadBE32(blocks[6] + t * 4), loadBE32(blocks[7] + t * 4)
+        );
+    }
+
+    __m256i v[8];
+    for(int i = 0; i < 8; i++) {
+        v[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state[i]));
+    }
+
+    __m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+    for(int t = 0; t < 64; t++) {
+        if(t >= 16) {
+            const __m256i w15 = w[(t - 15) & 15];
+            const __m256i w2 = w[(t - 2) & 15];
+            const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w15, 7), rotr8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w2, 17), rotr8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+        }
+
+        const __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(e, 6), rotr8(e, 11)), rotr8(e, 25));
+        const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(ch, _mm256_set1_epi32(static_cast<int>(K[t])))), w[t & 15]);
+        const __m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(a, 2), rotr8(a, 13)), rotr8(a, 22));
+        const __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)), _mm256_and_si256(b, c));
+        const __m256i t2 = _mm256_add_epi32(sum0, maj);
+
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    const __m256i result[8] = {a, b, c, d, e, f, g, h};
+    for(int i = 0; i < 8; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state[i]), _mm256_add_epi32(v[i], result[i]));
+    }
+}
+
+auto cpuHasShaNi() -> bool {
+    __builtin_cpu_init();
+
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    return (ebx & (1 << 29)) != 0 && __builtin_cpu_supports("sse4.1");
+}
+
+auto cpuHasAvx2() -> bool {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+auto cpuHasShaNi() -> bool {
+    return false;
+}
+
+auto cpuHasAvx2() -> bool {
+    return false;
+}
+
+#endif
+
+auto selectCompress() -> CompressFunc {
+#ifdef SHA256_X86
+    if(cpuHasShaNi()) {
+        return compressShaNi;
+    }
+#endif
+
+    return compressScalar;
+}
+
+const CompressFunc compress = selectCompress();
+const bool use_multi_buffer = !cpuHasShaNi() && cpuHasAvx2();
+
+//The padded tail of a message, the last partial block plus the length
+struct Tail {
+    u8 data[128];
+    size_t blocks;
+};
+
+auto makeTail(const u8 *data, size_t size) -> Tail {
+    Tail tail{};
+    const size_t remaining = size % 64;
+
+    std::memcpy(tail.data, data + (size - remaining), remaining);
+    tail.data[remaining] = 0x80;
+    tail.blocks = remaining + 9 <= 64 ? 1 : 2;
+
+    const u64 bits = static_cast<u64>(size) * 8;
+    for(int i = 0; i < 8; i++) {
+        tail.data[tail.blocks * 64 - 1 - i] = static_cast<u8>(bits >> (i * 8));
+    }
+
+    return tail;
+}
+
+auto stateToHash(const u32 state[8]) -> Sha256Hash {
+    Sha256Hash hash;
+
+    for(int i = 0; i < 8; i++) {
+        hash[i * 4 + 0] = static_cast<u8>(state[i] >> 24);
+        hash[i * 4 + 1] = static_cast<u8>(state[i] >> 16);
+        hash[i * 4 + 2] = static_cast<u8>(state[i] >> 8);
+        hash[i * 4 + 3] = static_cast<u8>(state[i]);
+    }
+
+    return hash;
+}
+
+#ifdef SHA256_X86
+
+//Keeps 8 messages in flight, each lane takes the next message as soon as its current one is done
+void sha256MultiAvx2(const u8 *const *data, const size_t *sizes, Sha256Hash *out, size_t count) {
+    struct Lane {
+        size_t message;
+        size_t block;
+        size_t full_blocks;
+        Tail tail;
+    };
+
+    alignas(32) u32 state[8][8];
+    static const u8 idle_block[64] = {};
+    Lane lanes[8];
+    bool active[8] = {};
+    size_t next_message = 0;
+    size_t active_count = 0;
+
+    while(true) {
+        //Refill the free lanes
+        for(int lane = 0; lane < 8 && next_message < count; lane++) {
+            if(!active[lane]) {
+                const size_t message = next_message++;
+                lanes[lane] = Lane{message, 0, sizes[message] / 64, makeTail(data[message], sizes[message])};
+                for(int i = 0; i < 8; i++) {
+                    state[i][lane] = INITIAL_STATE[i];
+                }
+
+                active[lane] = true;
+                active_count++;
+            }
+        }
+
+        //Not worth running the vector code for a single message, finish it off normally
+        if(active_count <= 1) {
+            for(int lane = 0; lane < 8; lane++) {
+                if(active[lane]) {
+                    const Lane &current = lanes[lane];
+                    u32 lane_state[8];
+                    for(int i = 0; i < 8; i++) {
+                        lane_state[i] = state[i][lane];
+                    }
+
+                    if(current.block < current.full_blocks) {
+                        compress(lane_state, data[current.message] + current.block * 64, current.full_blocks - current.block);
+                    }
+
+                    const size_t tail_start = current.block > current.full_blocks ? current.block - current.full_blocks : 0;
+                    compress(lane_state, current.tail.data + tail_start * 64, current.tail.blocks - tail_start);
+                    out[current.message] = stateToHash(lane_state);
+                }
+            }
+
+            return;
+        }
+
+        const u8 *blocks[8];
+        for(int lane = 0; lane < 8; lane++) {
+            const Lane &current = lanes[lane];
+
+            if(!active[lane]) {
+                blocks[lane] = idle_block;
+            } else if(current.block < current.full_blocks) {
+                blocks[lane] = data[current.message] + current.block * 64;
+            } else {
+                blocks[lane] = current.tail.data + (current.block - current.full_blocks) * 64;
+            }
+        }
+
+        compressAvx2(state, blocks);
+
+        for(int lane = 0; lane < 8; lane++) {
+            if(active[lane] && ++lanes[lane].block == lanes[lane].full_blocks + lanes[lane].tail.blocks) {
+                u32 lane_state[8];
+                for(int i = 0; i < 8; i++) {
+                    lane_state[i] = state[i][lane];
+                }
+
+                out[lanes[lane].message] = stateToHash(lane_state);
+                active[lane] = false;
+                active_count--;
+            }
+        }
+    }
+}
+
+#endif
+
+} //namespace
+
+auto sha256(const u8 *data, size_t size) -> Sha256Hash {
+    u32 state[8];
+    std::memcpy(state, INITIAL_STATE, sizeof(state));
+
+    compress(state, data, size / 64);
+    const Tail tail = makeTail(data, size);
+    compress(state, tail.data, tail.blocks);
+
+    return stateToHash(state);
+}
+
+void sha256Multi(const u8 *const *data, const size_t *sizes, Sha256Hash *out, size_t count) {
+#ifdef SHA256_X86
+    if(use_multi_buffer && count > 1) {
+        sha256MultiAvx2(data, sizes, out, count);
+        return;
+    }
+#endif
+
+    for(size_t i = 0; i < count; i++) {
+        out[i] = sha256(data[i], sizes[i]);
+    }
+}
\ No newline at end of file
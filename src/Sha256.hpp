@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Types.hpp"
+#include <array>
+
+
+using Sha256Hash = std::array<u8, 32>;
+
+//Uses the SHA extensions when the CPU has them, otherwise a portable implementation
+auto sha256(const u8 *data, size_t size) -> Sha256Hash;
+
+//Hashes several independent messages. Without the SHA extensions but with AVX2
+//up to 8 messages are hashed side by side, one per vector lane.
+void sha256Multi(const u8 *const *data, const size_t *sizes, Sha256Hash *out, size_t count);
\ No newline at end of file
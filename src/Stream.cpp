@@ -0,0 +1,419 @@
+#include "Stream.hpp"
+#include "NCSD.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+
+namespace {
+
+//Largest single read from the input
+constexpr size_t READ_CHUNK = 1024 * 1024;
+
+//Gets the bytes collected so far, returns how many it needs in total. Asking for
+//more than it was given keeps collecting, which lets headers be read in stages.
+using ParseFunction = std::function<size_t(const std::vector<u8>&)>;
+
+//Where the bytes of a range of the input go once they arrive, either an output file or a parser
+struct Sink {
+    Region region;
+    std::filesystem::path path;
+    ParseFunction parse;
+};
+
+struct ActiveSink {
+    Sink sink;
+    std::unique_ptr<std::ofstream> file;
+    std::vector<u8> buffer;
+};
+
+class Streamer {
+public:
+
+    Streamer(std::FILE *input, const std::string &dump_dir, const StreamOptions &options);
+
+    auto run() -> bool;
+
+private:
+
+    void add(Sink sink);
+    void addFile(const RomFSTree &tree, u32 file, const std::u16string &parent, size_t file_data);
+    void addDirectory(const RomFSTree &tree, u32 dir, const std::u16string &parent_path, size_t file_data);
+    void activate(Sink sink);
+    void decrypt(u8 *data, size_t size) const;
+
+    auto onImageHeader(const std::vector<u8> &buffer) -> size_t;
+    void onNCCHHeader(const std::vector<u8> &buffer, size_t offset, int partition);
+    void onExeFSHeader(const std::vector<u8> &buffer, size_t offset, const std::string &partition_dir, const std::vector<EncryptedRegion> &code_crypto);
+    auto onRomFSMetadata(const std::vector<u8> &buffer, size_t offset, int partition, const std::string &partition_dir) -> size_t;
+
+    std::FILE *input;
+    size_t position; //Offset of the next byte read from the input
+    std::string dump_dir;
+    const StreamOptions &options;
+    bool ncsd;
+    bool failed;
+    std::multimap<size_t, Sink> pending; //By start offset
+    std::vector<ActiveSink> active;
+    std::vector<EncryptedRegion> encrypted;
+    std::vector<u8> chunk;
+};
+
+Streamer::Streamer(std::FILE *input, const std::string &dump_dir, const StreamOptions &options) :
+    input(input), position(0), dump_dir(dump_dir), options(options), ncsd(false), failed(false), chunk(READ_CHUNK) {}
+
+auto Streamer::run() -> bool {
+    add(Sink{Region{0, 0x200}, {}, [this](const std::vector<u8> &buffer) { return onImageHeader(buffer); }});
+
+    while(!pending.empty() || !active.empty()) {
+        //Everything that starts here starts collecting, anything that started earlier has already gone by
+        while(!pending.empty() && pending.begin()->first <= position) {
+            Sink sink = std::move(pending.begin()->second);
+            pending.erase(pending.begin());
+
+            if(sink.region.offset < position) {
+                printf("Skipping %s at 0x%zX, it comes before its metadata in the stream\n",
+                    sink.parse ? "metadata" : ("'" + sink.path.string() + "'").c_str(), sink.region.offset);
+                continue;
+            }
+
+            activate(std::move(sink));
+        }
+
+        //Reads stop wherever something starts or ends, so every active sink takes the whole read
+        size_t end = position + READ_CHUNK;
+        if(!pending.empty()) {
+            end = std::min(end, pending.begin()->first);
+        }
+        for(const auto &sink : active) {
+            end = std::min(end, sink.sink.region.offset + sink.sink.region.size);
+        }
+
+        const size_t size = end - position;
+        const size_t read = std::fread(chunk.data(), 1, size, input);
+        if(read != size) {
+            printf("Error: The input ended at 0x%zX, before everything was extracted!\n", position + read);
+            return false;
+        }
+
+        if(!active.empty()) {
+            decrypt(chunk.data(), size);
+        }
+
+        for(auto &sink : active) {
+            if(sink.file != nullptr) {
+                sink.file->write(reinterpret_cast<const char*>(chunk.data()), size);
+            } else {
+                sink.buffer.insert(sink.buffer.end(), chunk.data(), chunk.data() + size);
+            }
+        }
+        position = end;
+
+        //Parsers can add sinks or ask for more data, they never touch the active list
+        for(size_t i = 0; i < active.size();) {
+            ActiveSink &sink = active[i];
+            if(sink.sink.region.offset + sink.sink.region.size != position) {
+                i++;
+                continue;
+            }
+
+            if(sink.file != nullptr) {
+                sink.file->close();
+                if(sink.file->fail()) {
+                    printf("Failed to dump file '%s'\n", sink.sink.path.string().c_str());
+                }
+            } else {
+                const size_t needed = sink.sink.parse(sink.buffer);
+                if(needed > sink.buffer.size()) {
+                    sink.sink.region.size = needed;
+                    i++;
+                    continue;
+                }
+            }
+
+            active.erase(active.begin() + i);
+        }
+    }
+
+    return !failed;
+}
+
+void Streamer::add(Sink sink) {
+    //Empty files have nothing to wait for
+    if(sink.region.size == 0) {
+        if(!sink.parse && !std::ofstream(sink.path, std::ios::binary | std::ios::trunc).is_open()) {
+            printf("Failed to dump file '%s'\n", sink.path.string().c_str());
+        }
+        return;
+    }
+
+    pending.emplace(sink.region.offset, std::move(sink));
+}
+
+void Streamer::addFile(const RomFSTree &tree, u32 file, const std::u16string &parent, size_t file_data) {
+    add(Sink{Region{file_data + tree.file_offsets[file], tree.file_sizes[file]}, parent + std::u16string(tree.fileName(file)), {}});
+}
+
+void Streamer::addDirectory(const RomFSTree &tree, u32 dir, const std::u16string &parent_path, size_t file_data) {
+    const std::u16string new_path = parent_path + std::u16string(tree.dirName(dir)) + u'/';
+    std::filesystem::create_directory(new_path);
+
+    for(u32 child = tree.dir_children[dir]; child != RomFSTree::NONE; child = tree.dir_siblings[child]) {
+        addDirectory(tree, child, new_path, file_data);
+    }
+
+    for(u32 file = tree.dir_files[dir]; file != RomFSTree::NONE; file = tree.file_siblings[file]) {
+        addFile(tree, file, new_path, file_data);
+    }
+}
+
+void Streamer::activate(Sink sink) {
+    ActiveSink activated{std::move(sink), nullptr, {}};
+
+    if(!activated.sink.parse) {
+        activated.file = std::make_unique<std::ofstream>(activated.sink.path, std::ios::binary | std::ios::trunc);
+        if(!activated.file->is_open()) {
+            printf("Failed to dump file '%s'\n", activated.sink.path.string().c_str());
+            return;
+        }
+    }
+
+    active.push_back(std::move(activated));
+}
+
+void Streamer::decrypt(u8 *data, size_t size) const {
+    for(const auto &region : encrypted) {
+        const size_t start = std::max(position, region.region.offset);
+        const size_t end = std::min(position + size, region.region.offset + region.region.size);
+
+        if(start < end) {
+            region.cipher->crypt(region.counter, start - region.stream_offset, data + (start - position), end - start);
+        }
+    }
+}
+
+auto Streamer::onImageHeader(const std::vector<u8> &buffer) -> size_t {
+    const Image image = Image::fromMemory(buffer);
+    const NCSDHeader header = parseNCSDHeader(image, 0);
+
+    if(header.magic == 0x4453434E) {
+        printf("NCSD\n");
+        ncsd = true;
+
+        for(int i = 0; i < 8; i++) {
+            if(options.partitions & (1 << i) && header.partition_table[i][1] > 0) {
+                const size_t offset = u64(header.partition_table[i][0]) * 0x200;
+                add(Sink{Region{offset, 0x200}, {}, [this, offset, i](const std::vector<u8> &ncch) {
+                    onNCCHHeader(ncch, offset, i);
+                    return ncch.size();
+                }});
+            }
+        }
+    } else if(header.magic == 0x4843434E) {
+        printf("NCCH\n");
+        onNCCHHeader(buffer, 0, 0);
+    } else {
+        printf("Error: File is neither an NCSD or NCCH!\n");
+        failed = true;
+    }
+
+    return buffer.size();
+}
+
+void Streamer::onNCCHHeader(const std::vector<u8> &buffer, size_t offset, int partition) {
+    const NCCHHeader header = parseNCCHHeader(Image::fromMemory(buffer), 0);
+
+    if(header.magic != 0x4843434E) {
+        printf("NCCH header magic doesn't match! (Expected: 0x4843434E, Actual: %08X)\n", header.magic);
+        failed = true;
+        return;
+    }
+
+    const std::string partition_dir = dump_dir + '/' + std::to_string(partition) + '/';
+    std::filesystem::create_directories(partition_dir);
+
+    const Region exefs{offset + u64(header.exefs_offset) * 0x200, u64(header.exefs_size) * 0x200};
+    const Region romfs{offset + u64(header.romfs_offset) * 0x200, u64(header.romfs_size) * 0x200};
+
+    //Same keys and counters as decryptNCCH(), applied to the data as it's read
+    //For .code, the ExeFS keystream applied again to undo it and then the secondary one. Regions are filled in per file.
+    std::vector<EncryptedRegion> code_crypto;
+    if(isNCCHEncrypted(header)) {
+        const Result<NCCHKeys> result = getNCCHKeys(header, options.keys);
+        if(!result) {
+            printf("Error: %s\n", result.error().message.c_str());
+            printf("Error: Failed to decrypt partition %i!\n", partition);
+            failed = true;
+            return;
+        }
+
+        const NCCHKeys &keys = result.value();
+        auto primary = std::make_shared<const AESCTR>(keys.primary);
+        const AESCounter exefs_counter = getNCCHCounter(header, EXEFS_SECTION, u64(header.exefs_offset) * 0x200);
+        encrypted.push_back(EncryptedRegion{exefs, exefs.offset, exefs_counter, primary});
+        encrypted.push_back(EncryptedRegion{romfs, romfs.offset, getNCCHCounter(header, ROMFS_SECTION, u64(header.romfs_offset) * 0x200),
+            std::make_shared<const AESCTR>(keys.secondary)});
+
+        if(keys.primary != keys.secondary) {
+            code_crypto.push_back(EncryptedRegion{{}, exefs.offset, exefs_counter, primary});
+            code_crypto.push_back(EncryptedRegion{{}, exefs.offset, exefs_counter, std::make_shared<const AESCTR>(keys.secondary)});
+        }
+    }
+
+    if(options.logo && header.logo_size > 0) {
+        add(Sink{Region{offset + u64(header.logo_offset) * 0x200, u64(header.logo_size) * 0x200}, partition_dir + "logo", {}});
+    }
+
+    if(options.plain_region && header.plain_size > 0) {
+        add(Sink{Region{offset + u64(header.plain_offset) * 0x200, u64(header.plain_size) * 0x200}, partition_dir + "plain_region", {}});
+    }
+
+    if(options.exefs && exefs.size > 0) {
+        add(Sink{Region{exefs.offset, 0x200}, {}, [this, exefs, partition_dir, code_crypto](const std::vector<u8> &exefs_header) {
+            onExeFSHeader(exefs_header, exefs.offset, partition_dir, code_crypto);
+            return exefs_header.size();
+        }});
+    }
+
+    const bool needs_romfs = options.romfs || !options.files.empty() || !options.dirs.empty() || options.print;
+    if(needs_romfs && romfs.size > 0) {
+        add(Sink{Region{romfs.offset, 0x60}, {}, [this, romfs, partition, partition_dir](const std::vector<u8> &metadata) {
+            return onRomFSMetadata(metadata, romfs.offset, partition, partition_dir);
+        }});
+    }
+}
+
+void Streamer::onExeFSHeader(const std::vector<u8> &buffer, size_t offset, const std::string &partition_dir, const std::vector<EncryptedRegion> &code_crypto) {
+    const ExeFSHeader header = parseExeFSHeader(Image::fromMemory(buffer), 0);
+    const std::string exefs_dir = partition_dir + "ExeFS/";
+    std::filesystem::create_directory(exefs_dir);
+
+    for(const auto &file : header.file_headers) {
+        if(file.size == 0) {
+            continue;
+        }
+
+        char name[9] = {0};
+        std::memcpy(name, file.name, sizeof(ExeFSFileHeader::name));
+        const Region region{offset + 0x200 + file.offset, file.size};
+
+        if(std::strncmp(name, ".code", sizeof(ExeFSFileHeader::name)) == 0) {
+            for(EncryptedRegion crypto : code_crypto) {
+                crypto.region = region;
+                encrypted.push_back(crypto);
+            }
+        }
+
+        add(Sink{region, exefs_dir + name, {}});
+    }
+}
+
+auto Streamer::onRomFSMetadata(const std::vector<u8> &buffer, size_t offset, int partition, const std::string &partition_dir) -> size_t {
+    const Image image = Image::fromMemory(buffer);
+    const RomFSHeader header = parseRomFSHeader(image, 0);
+    IVFCLevel levels[3];
+
+    if(header.magic != 0x43465649 || header.magic_num != 0x10000 || !getIVFCLevels(header, 0, levels)) {
+        printf("Error: The RomFS header of partition %i is invalid!\n", partition);
+        failed = true;
+        return buffer.size();
+    }
+
+    //Then the level 3 header, then everything up to the file data, which includes the tables
+    const size_t level3 = levels[2].data.offset;
+    if(buffer.size() < level3 + 0x28) {
+        return level3 + 0x28;
+    }
+
+    const Level3Header lvl3_header = parseLevel3Header(image, level3);
+    u64 metadata_end = lvl3_header.file_data_offset;
+    for(const auto &[table_offset, table_length] : {
+        std::pair{lvl3_header.dir_hash_offset, lvl3_header.dir_hash_length}, std::pair{lvl3_header.dir_meta_offset, lvl3_header.dir_meta_length},
+        std::pair{lvl3_header.file_hash_offset, lvl3_header.file_hash_length}, std::pair{lvl3_header.file_meta_offset, lvl3_header.file_meta_length}}) {
+        metadata_end = std::max(metadata_end, u64(table_offset) + table_length);
+    }
+
+    if(metadata_end > levels[2].data.size) {
+        printf("Error: The RomFS metadata of partition %i is invalid!\n", partition);
+        failed = true;
+        return buffer.size();
+    }
+
+    if(buffer.size() < level3 + metadata_end) {
+        return level3 + metadata_end;
+    }
+
+    const Result<RomFS> parsed = parseRomFS(image, 0);
+    if(!parsed) {
+        printf("Error: %s\n", parsed.error().message.c_str());
+        failed = true;
+        return buffer.size();
+    }
+
+    const RomFS &romfs = parsed.value();
+    if(options.print) {
+        if(ncsd) {
+            printf("Partition %i:\n", partition);
+        }
+        options.print(romfs.tree);
+    }
+
+    const size_t file_data = offset + romfs.level3.file_data.offset;
+    if(options.romfs) {
+        addDirectory(romfs.tree, 0, std::u16string(partition_dir.begin(), partition_dir.end()), file_data);
+    } else {
+        const std::string romfs_dir = partition_dir + "RomFS/";
+        for(const auto &file_path : options.files) {
+            std::optional<u32> result = lookupFile(romfs, decodeUtf8(file_path).value());
+            if(result.has_value()) {
+                std::filesystem::path parent_dir = std::filesystem::path(romfs_dir + file_path).parent_path();
+                std::filesystem::create_directories(parent_dir);
+                addFile(romfs.tree, result.value(), parent_dir.u16string() + u'/', file_data);
+            }
+        }
+
+        for(const auto &dir_path : options.dirs) {
+            std::optional<u32> result = lookupDirectory(romfs, decodeUtf8(dir_path).value());
+            if(result.has_value()) {
+                std::filesystem::path parent_dir = std::filesystem::path(romfs_dir + dir_path).parent_path();
+                std::filesystem::create_directories(parent_dir);
+                addDirectory(romfs.tree, result.value(), parent_dir.u16string() + u'/', file_data);
+            }
+        }
+    }
+
+    return buffer.size();
+}
+
+} //namespace
+
+auto streamImage(const std::string &path, const std::string &dump_dir, const StreamOptions &options) -> bool {
+    std::FILE *input = path == "-" ? stdin : std::fopen(path.c_str(), "rb");
+    if(input == nullptr) {
+        printf("Error: Failed to open file!\n");
+        return false;
+    }
+
+#ifdef _WIN32
+    if(input == stdin) {
+        _setmode(_fileno(stdin), _O_BINARY);
+    }
+#endif
+
+    const bool success = Streamer(input, dump_dir, options).run();
+
+    if(input != stdin) {
+        std::fclose(input);
+    }
+
+    return success;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Crypto.hpp"
+#include "RomFS.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+
+//What to extract from a streamed image, the same choices as a normal dump
+struct StreamOptions {
+    u8 partitions;
+    bool romfs;
+    bool exefs;
+    bool logo;
+    bool plain_region;
+    std::vector<std::string> files; //Valid UTF-8
+    std::vector<std::string> dirs;
+    const KeyFile *keys;
+    std::function<void(const RomFSTree&)> print; //If set, called with the tree of each RomFS
+};
+
+//Extracts an image from an input that can only be read once, front to back, like a pipe
+//from a decompressor, "-" reads stdin. Headers and RomFS metadata are parsed as they
+//arrive and every output file is written while its data goes by, so only the metadata
+//and a fixed size read buffer are held in memory. Anything whose data comes before the
+//metadata describing it can't be extracted this way, it is reported and skipped.
+auto streamImage(const std::string &path, const std::string &dump_dir, const StreamOptions &options) -> bool;
\ No newline at end of file
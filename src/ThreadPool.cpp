@@ -0,0 +1,150 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+
+namespace {
+
+//Lets push() find the calling worker's own queue
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+} //namespace
+
+TaskGroup::TaskGroup() : pending(0) {}
+
+void TaskGroup::wait() {
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+}
+
+void TaskGroup::finish() {
+    //Under the lock, otherwise the waiter could return and destroy the group before it's notified
+    std::lock_guard lock(mutex);
+    if(--pending == 0) {
+        finished.notify_all();
+    }
+}
+
+ThreadPool::ThreadPool(size_t thread_count) : queued(0), pending(0), next_queue(0), stopping(false) {
+    thread_count = std::max<size_t>(thread_count, 1);
+
+    for(size_t i = 0; i < thread_count; i++) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for(size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+
+    {
+        std::lock_guard lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for(auto &worker : workers) {
+        worker.join();
+    }
+}
+
+auto ThreadPool::size() const -> size_t {
+    return workers.size();
+}
+
+void ThreadPool::submit(Task task) {
+    push(std::move(task));
+}
+
+void ThreadPool::submit(Task task, TaskGroup &group) {
+    {
+        std::lock_guard lock(group.mutex);
+        group.pending++;
+    }
+
+    push([task = std::move(task), &group] {
+        task();
+        group.finish();
+    });
+}
+
+void ThreadPool::push(Task task) {
+    const size_t index = current_pool == this ? current_index : next_queue++ % queues.size();
+    pending++;
+
+    {
+        std::lock_guard lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    queued++;
+
+    //Taking the lock makes sure a worker that just found nothing to do is either
+    //already waiting or will see the new task when it checks again
+    {
+        std::lock_guard lock(wake_mutex);
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock lock(wake_mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+}
+
+auto ThreadPool::popTask(size_t index, Task &task) -> bool {
+    //Own queue first, newest task
+    {
+        WorkerQueue &own = *queues[index];
+        std::lock_guard lock(own.mutex);
+        if(!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    //Then try to steal the oldest task from everyone else
+    for(size_t i = 1; i < queues.size(); i++) {
+        WorkerQueue &victim = *queues[(index + i) % queues.size()];
+        std::lock_guard lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    while(true) {
+        Task task;
+
+        if(!popTask(index, task)) {
+            std::unique_lock lock(wake_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+
+            if(stopping && queued == 0) {
+                return;
+            }
+
+            continue;
+        }
+
+        task();
+
+        if(--pending == 0) {
+            std::lock_guard lock(wake_mutex);
+            finished.notify_all();
+        }
+    }
+}
\ No newline at end of file
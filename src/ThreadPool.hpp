@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Types.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//Tracks a subset of a pool's tasks, so they can be waited on without waiting for
+//everything else in the pool
+class TaskGroup {
+public:
+
+    TaskGroup();
+    TaskGroup(const TaskGroup&) = delete;
+    auto operator=(const TaskGroup&) -> TaskGroup& = delete;
+
+    //Blocks until every task in the group has finished, don't call it from one of the pool's tasks
+    void wait();
+
+private:
+
+    friend class ThreadPool;
+
+    void finish();
+
+    size_t pending;
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+//A work-stealing thread pool. Each worker has its own deque, tasks submitted
+//from a worker go to that worker's deque and are run newest first, while idle
+//workers steal the oldest tasks from the other deques.
+class ThreadPool {
+public:
+
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    auto size() const -> size_t;
+    void submit(Task task);
+    void submit(Task task, TaskGroup &group);
+
+    //Blocks until every submitted task, including ones submitted by other tasks, has finished
+    void wait();
+
+private:
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+    void workerLoop(size_t index);
+    auto popTask(size_t index, Task &task) -> bool;
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::atomic<size_t> queued;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> next_queue;
+    bool stopping;
+};
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "Uring.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace {
+
+auto ioUringSetup(unsigned entries, io_uring_params &params) -> int {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+auto ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) -> int {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+auto ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned count) -> int {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+} //namespace
+
+auto IoUring::create(unsigned entries, unsigned file_slots) -> std::unique_ptr<IoUring> {
+    std::unique_ptr<IoUring> ring(new IoUring());
+
+    io_uring_params params{};
+    ring->fd = ioUringSetup(entries, params);
+    if(ring->fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        return nullptr;
+    }
+
+    //Both rings share one mapping
+    ring->rings_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring->rings = mmap(nullptr, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->rings == MAP_FAILED) {
+        ring->rings = nullptr;
+        return nullptr;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+    u8 *base = static_cast<u8*>(ring->rings);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    ring->sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    ring->sq_mask = reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    ring->sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    ring->cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    ring->cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    ring->cq_mask = reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    ring->cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->submitted_tail = ring->sqe_tail;
+
+    //An empty slot table, files are opened straight into it
+    const std::vector<int> slots(file_slots, -1);
+    if(ioUringRegister(ring->fd, IORING_REGISTER_FILES, slots.data(), file_slots) != 0) {
+        return nullptr;
+    }
+
+    //Opening into a slot is the newest feature used, try it once
+    io_uring_sqe *open_sqe = ring->getSqe();
+    open_sqe->opcode = IORING_OP_OPENAT;
+    open_sqe->fd = AT_FDCWD;
+    open_sqe->addr = reinterpret_cast<u64>(".");
+    open_sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    open_sqe->file_index = 1;
+    open_sqe->flags = IOSQE_IO_HARDLINK;
+
+    io_uring_sqe *close_sqe = ring->getSqe();
+    close_sqe->opcode = IORING_OP_CLOSE;
+    close_sqe->file_index = 1;
+
+    if(!ring->submit(2)) {
+        return nullptr;
+    }
+
+    bool supported = true;
+    ring->reap([&supported](u64, s32 res) { supported &= res >= 0; });
+    return supported ? std::move(ring) : nullptr;
+}
+
+IoUring::~IoUring() {
+    if(sqes != nullptr) {
+        munmap(sqes, sqes_size);
+    }
+
+    if(rings != nullptr) {
+        munmap(rings, rings_size);
+    }
+
+    if(fd >= 0) {
+        ::close(fd);
+    }
+}
+
+auto IoUring::getSqe() -> io_uring_sqe* {
+    if(sqSpace() == 0) {
+        return nullptr;
+    }
+
+    const unsigned index = sqe_tail & *sq_mask;
+    sq_array[index] = index;
+    sqe_tail++;
+
+    io_uring_sqe *sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+auto IoUring::sqSpace() const -> unsigned {
+    return sq_entries - (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+}
+
+auto IoUring::submit(unsigned wait_for) -> bool {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+
+    while(true) {
+        const unsigned to_submit = sqe_tail - submitted_tail;
+        const int submitted = ioUringEnter(fd, to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+
+        if(submitted >= 0) {
+            submitted_tail += submitted;
+            return true;
+        } else if(errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Types.hpp"
+#include <memory>
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+
+
+//A minimal io_uring set up with the raw system calls, so there is no dependency on liburing.
+//It comes with a table of registered file slots for direct descriptors. Not thread-safe,
+//one thread queues, submits and reaps.
+class IoUring {
+public:
+
+    //nullptr if the kernel doesn't have io_uring, has it disabled or doesn't support
+    //opening into direct descriptors (5.15 and later), so the caller can fall back
+    static auto create(unsigned entries, unsigned file_slots) -> std::unique_ptr<IoUring>;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    auto operator=(const IoUring&) -> IoUring& = delete;
+
+    //The next submission queue entry, zeroed. nullptr if the queue is full, submit first.
+    auto getSqe() -> io_uring_sqe*;
+    auto sqSpace() const -> unsigned;
+    //Submits everything queued and waits until at least wait_for completions are ready
+    auto submit(unsigned wait_for) -> bool;
+
+    //Calls handle(user_data, res) for every completion that is ready
+    template<typename Handle>
+    void reap(Handle handle) {
+        unsigned head = *cq_head;
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+        for(; head != tail; head++) {
+            const io_uring_cqe &cqe = cqes[head & *cq_mask];
+            handle(cqe.user_data, cqe.res);
+        }
+
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+private:
+
+    IoUring() = default;
+
+    int fd = -1;
+    void *rings = nullptr;
+    size_t rings_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned sq_entries = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned sqe_tail = 0;      //Queued entries, published to the kernel on submit
+    unsigned submitted_tail = 0; //Entries the kernel has consumed
+
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "Verify.hpp"
+#include <algorithm>
+#include <cstring>
+
+
+namespace {
+
+//Regions at least this big get a task to themselves, smaller ones are hashed 8 at a time
+constexpr size_t LARGE_REGION = 1024 * 1024;
+//Roughly how much of an IVFC level each task hashes
+constexpr size_t IVFC_TASK_BYTES = 4 * 1024 * 1024;
+
+auto makeCheck(std::string name, const Region &region, const u8 *expected) -> HashCheck {
+    HashCheck check{std::move(name), region, {}, false};
+    std::memcpy(check.expected.data(), expected, check.expected.size());
+    return check;
+}
+
+void hashChecks(const Image &image, HashCheck *const *checks, size_t count) {
+    std::vector<const u8*> data;
+    std::vector<size_t> sizes;
+    std::vector<HashCheck*> valid;
+    std::vector<Sha256Hash> results;
+
+    for(size_t i = 0; i < count; i++) {
+        const Region &region = checks[i]->region;
+
+        //A region that runs off the end of the image can't match
+        if(!image.contains(region)) {
+            checks[i]->passed = false;
+            continue;
+        }
+
+        data.push_back(image.data() + region.offset);
+        sizes.push_back(region.size);
+        valid.push_back(checks[i]);
+    }
+
+    results.resize(valid.size());
+    sha256Multi(data.data(), sizes.data(), results.data(), valid.size());
+
+    for(size_t i = 0; i < valid.size(); i++) {
+        valid[i]->passed = results[i] == valid[i]->expected;
+        image.release(valid[i]->region.offset, valid[i]->region.size);
+    }
+}
+
+//Points at a block of a level in the mapping, or copies it into scratch (block_size bytes)
+//when it has to be zero padded to the full block size or decrypted first
+auto blockData(const Image &image, const IVFCLevel &level, size_t block, u8 *scratch) -> const u8* {
+    const Region region{level.data.offset + block * level.block_size, std::min(level.block_size, level.data.size - block * level.block_size)};
+
+    if(region.size == level.block_size && !image.isEncrypted(region)) {
+        return image.data() + region.offset;
+    }
+
+    image.read(region.offset, scratch, region.size);
+    std::fill(scratch + region.size, scratch + level.block_size, 0);
+    return scratch;
+}
+
+//Hashes blocks [first, last) of a level and compares them with the hashes in the level above it
+void hashBlocks(const Image &image, const IVFCLevel &level, const Region &hashes, int level_num, size_t first, size_t last, std::vector<IVFCFailure> &failures) {
+    std::vector<const u8*> data;
+    std::vector<size_t> sizes;
+    std::vector<Sha256Hash> results(last - first);
+
+    //Encrypted blocks all need their own copy, otherwise only the last block can need one
+    const bool encrypted = image.isEncrypted(level.data);
+    std::vector<u8> scratch((encrypted ? last - first : 1) * level.block_size);
+
+    for(size_t block = first; block < last; block++) {
+        data.push_back(blockData(image, level, block, scratch.data() + (encrypted ? block - first : 0) * level.block_size));
+        sizes.push_back(level.block_size);
+    }
+
+    sha256Multi(data.data(), sizes.data(), results.data(), results.size());
+    image.release(level.data.offset + first * level.block_size, (last - first) * level.block_size);
+
+    for(size_t block = first; block < last; block++) {
+        const size_t hash_offset = block * sizeof(Sha256Hash);
+        const bool has_hash = hash_offset + sizeof(Sha256Hash) <= hashes.size;
+
+        if(!has_hash || std::memcmp(image.data() + hashes.offset + hash_offset, results[block - first].data(), sizeof(Sha256Hash)) != 0) {
+            failures.push_back(IVFCFailure{level_num, block});
+        }
+    }
+}
+
+} //namespace
+
+auto collectHashChecks(const NCCH &ncch) -> std::vector<HashCheck> {
+    std::vector<HashCheck> checks;
+    const NCCHHeader &header = ncch.header;
+
+    if(header.exheader_size > 0) {
+        checks.push_back(makeCheck("ExHeader", Region{ncch.offset + 0x200, header.exheader_size}, header.exheader_hash));
+    }
+
+    if(ncch.logo.has_value()) {
+        checks.push_back(makeCheck("Logo", ncch.logo.value(), header.logo_hash));
+    }
+
+    if(header.exefs_size > 0) {
+        checks.push_back(makeCheck("ExeFS", mediaRegion(ncch.offset, header.exefs_offset, header.exefs_hash_size), header.exefs_super_hash));
+    }
+
+    //An invalid ExeFS only gets the check above, which can still show whether it is corrupt
+    const Result<const ExeFS*> exefs = ncch.exefs();
+    if(exefs && exefs.value() != nullptr) {
+        //The file hashes are stored in reverse order
+        for(int i = 0; i < 10; i++) {
+            if(exefs.value()->header.file_headers[i].size > 0) {
+                char name[9] = {0};
+                std::memcpy(name, exefs.value()->header.file_headers[i].name, sizeof(ExeFSFileHeader::name));
+                checks.push_back(makeCheck(std::string("ExeFS/") + name, exefs.value()->file_data[i], exefs.value()->header.file_hashes[9 - i]));
+            }
+        }
+    }
+
+    if(header.romfs_size > 0) {
+        checks.push_back(makeCheck("RomFS", mediaRegion(ncch.offset, header.romfs_offset, header.romfs_hash_size), header.romfs_super_hash));
+    }
+
+    return checks;
+}
+
+auto runHashChecks(const Image &image, std::vector<HashCheck> &checks, ThreadPool *pool) -> bool {
+    //Biggest first so the large regions start hashing right away
+    std::vector<HashCheck*> order;
+    for(auto &check : checks) {
+        order.push_back(&check);
+    }
+    std::sort(order.begin(), order.end(), [](const HashCheck *a, const HashCheck *b) { return a->region.size > b->region.size; });
+
+    //Only wait for these tasks, the pool can be busy with other work
+    TaskGroup group;
+    size_t start = 0;
+    while(start < order.size()) {
+        const size_t count = order[start]->region.size >= LARGE_REGION ? 1 : std::min<size_t>(8, order.size() - start);
+        HashCheck *const *batch = order.data() + start;
+
+        if(pool != nullptr) {
+            pool->submit([&image, batch, count] { hashChecks(image, batch, count); }, group);
+        } else {
+            hashChecks(image, batch, count);
+        }
+
+        start += count;
+    }
+
+    if(pool != nullptr) {
+        group.wait();
+    }
+
+    return std::all_of(checks.begin(), checks.end(), [](const HashCheck &check) { return check.passed; });
+}
+
+auto verifyIVFC(const RomFS &romfs, ThreadPool *pool) -> std::vector<IVFCFailure> {
+    const Image &image = *romfs.image;
+    const Region master_hash{romfs.offset + 0x60, romfs.header.master_hash_size};
+
+    //One list of failures per task so the tasks don't have to share anything
+    struct Task {
+        int level;
+        size_t first;
+        size_t last;
+        std::vector<IVFCFailure> failures;
+    };
+    std::vector<Task> tasks;
+    std::vector<IVFCFailure> failures;
+
+    for(int i = 0; i < 3; i++) {
+        const IVFCLevel &level = romfs.levels[i];
+        const Region &hashes = i == 0 ? master_hash : romfs.levels[i - 1].data;
+
+        //Nothing in a level that isn't entirely inside the image can be trusted
+        if(!image.contains(level.data) || !image.contains(hashes)) {
+            failures.push_back(IVFCFailure{i + 1, 0});
+            continue;
+        }
+
+        const size_t block_count = (level.data.size + level.block_size - 1) / level.block_size;
+        const size_t blocks_per_task = std::max<size_t>(1, IVFC_TASK_BYTES / level.block_size);
+
+        for(size_t first = 0; first < block_count; first += blocks_per_task) {
+            tasks.push_back(Task{i, first, std::min(first + blocks_per_task, block_count), {}});
+        }
+
+        image.advise(level.data.offset, level.data.size, Image::Access::Sequential);
+    }
+
+    TaskGroup group;
+    for(auto &task : tasks) {
+        const IVFCLevel level = romfs.levels[task.level];
+        const Region hashes = task.level == 0 ? master_hash : romfs.levels[task.level - 1].data;
+        auto run = [&image, level, hashes, &task] {
+            hashBlocks(image, level, hashes, task.level + 1, task.first, task.last, task.failures);
+        };
+
+        if(pool != nullptr) {
+            pool->submit(run, group);
+        } else {
+            run();
+        }
+    }
+
+    if(pool != nullptr) {
+        group.wait();
+    }
+
+    for(const auto &task : tasks) {
+        failures.insert(failures.end(), task.failures.begin(), task.failures.end());
+    }
+
+    std::sort(failures.begin(), failures.end(), [](const IVFCFailure &a, const IVFCFailure &b) {
+        return a.level != b.level ? a.level < b.level : a.block < b.block;
+    });
+
+    return failures;
+}
+
+auto filesInBlock(const RomFS &romfs, size_t block) -> std::vector<u32> {
+    const RomFSTree &tree = romfs.tree;
+    const size_t block_size = romfs.levels[2].block_size;
+
+    //Level 3 offsets of the block, the file offsets are relative to the start of the file data
+    const size_t start = block * block_size;
+    const size_t end = start + block_size;
+    const size_t data_start = romfs.level3.file_data.offset - romfs.levels[2].data.offset;
+
+    std::vector<u32> files;
+    for(u32 file = 0; file < tree.fileCount(); file++) {
+        const size_t file_start = data_start + tree.file_offsets[file];
+        const size_t file_end = file_start + tree.file_sizes[file];
+
+        if(file_start < end && file_end > start && tree.file_sizes[file] > 0) {
+            files.push_back(file);
+        }
+    }
+
+    return files;
+}
+
+BlockVerifier::BlockVerifier(const RomFS &romfs) : romfs(romfs), master_hash{romfs.offset + 0x60, romfs.header.master_hash_size}, any_failed(false) {
+    const Image &image = *romfs.image;
+
+    for(int i = 0; i < 3; i++) {
+        const IVFCLevel &level = romfs.levels[i];
+        const Region &hashes = i == 0 ? master_hash : romfs.levels[i - 1].data;
+
+        block_counts[i] = (level.data.size + level.block_size - 1) / level.block_size;
+        usable[i] = image.contains(level.data) && image.contains(hashes);
+
+        //Value initialised, so every bit starts cleared
+        verified[i] = std::vector<std::atomic<u64>>(usable[i] ? (block_counts[i] + 63) / 64 : 0);
+        mismatched[i] = std::vector<std::atomic<u64>>(verified[i].size());
+    }
+}
+
+auto BlockVerifier::verify(const Region &region) -> bool {
+    const IVFCLevel &level = romfs.levels[2];
+
+    if(region.size == 0) {
+        return true;
+    }
+
+    if(region.offset < level.data.offset || region.offset - level.data.offset + region.size > level.data.size) {
+        any_failed = true;
+        return false;
+    }
+
+    const size_t first = (region.offset - level.data.offset) / level.block_size;
+    const size_t last = (region.offset - level.data.offset + region.size - 1) / level.block_size;
+
+    bool passed = true;
+    for(size_t block = first; block <= last; block++) {
+        passed &= verifyBlock(2, block);
+    }
+
+    return passed;
+}
+
+auto BlockVerifier::failed() const -> bool {
+    return any_failed;
+}
+
+auto BlockVerifier::verifyBlock(int level_index, size_t block) -> bool {
+    if(!usable[level_index] || block >= block_counts[level_index]) {
+        any_failed = true;
+        return false;
+    }
+
+    const u64 bit = u64(1) << (block % 64);
+    if(verified[level_index][block / 64] & bit) {
+        return true;
+    }
+    if(mismatched[level_index][block / 64] & bit) {
+        return false;
+    }
+
+    //Two threads can end up hashing the same block, which is harmless
+    const Image &image = *romfs.image;
+    const IVFCLevel &level = romfs.levels[level_index];
+    const Region &hashes = level_index == 0 ? master_hash : romfs.levels[level_index - 1].data;
+    const size_t hash_offset = block * sizeof(Sha256Hash);
+
+    //The hash itself has to come from a block that checks out
+    bool passed = hash_offset + sizeof(Sha256Hash) <= hashes.size;
+    if(passed && level_index > 0) {
+        passed = verifyBlock(level_index - 1, hash_offset / romfs.levels[level_index - 1].block_size);
+    }
+
+    if(passed) {
+        thread_local std::vector<u8> scratch;
+        scratch.resize(level.block_size);
+        const Sha256Hash hash = sha256(blockData(image, level, block, scratch.data()), level.block_size);
+        image.release(level.data.offset + block * level.block_size, level.block_size);
+        passed = std::memcmp(image.data() + hashes.offset + hash_offset, hash.data(), hash.size()) == 0;
+    }
+
+    if(passed) {
+        verified[level_index][block / 64] |= bit;
+    } else {
+        mismatched[level_index][block / 64] |= bit;
+        any_failed = true;
+    }
+
+    return passed;
+}
\ No newline at end of file
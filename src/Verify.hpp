@@ -0,0 +1,63 @@
+#pragma once
+
+#include "NCCH.hpp"
+#include "Sha256.hpp"
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+struct HashCheck {
+    std::string name;
+    Region region;
+    Sha256Hash expected;
+    bool passed;
+};
+
+struct IVFCFailure {
+    int level; //1 to 3
+    size_t block;
+};
+
+//The hashes stored in the NCCH header and the ExeFS header
+auto collectHashChecks(const NCCH &ncch) -> std::vector<HashCheck>;
+
+//Hashes every region, spread over the pool if there is one. Returns true if everything matched.
+auto runHashChecks(const Image &image, std::vector<HashCheck> &checks, ThreadPool *pool) -> bool;
+
+//Checks every block of the RomFS IVFC tree: level 1 against the master hash, level 2
+//against level 1 and level 3 against level 2. All levels are hashed at once, spread
+//over the pool if there is one. Returns the failing blocks ordered by level then block.
+auto verifyIVFC(const RomFS &romfs, ThreadPool *pool) -> std::vector<IVFCFailure>;
+
+//The files whose data overlaps a level 3 block
+auto filesInBlock(const RomFS &romfs, size_t block) -> std::vector<u32>;
+
+//Verifies level 3 blocks against the IVFC tree only when they are read, along with
+//the level 1 and 2 blocks holding their hashes. Every block is hashed at most once,
+//the result is kept in a pair of bitmaps per level. Safe to use from several threads.
+class BlockVerifier {
+public:
+
+    explicit BlockVerifier(const RomFS &romfs);
+    BlockVerifier(const BlockVerifier&) = delete;
+    auto operator=(const BlockVerifier&) -> BlockVerifier& = delete;
+
+    //Checks the level 3 blocks overlapping an absolute region of the image
+    auto verify(const Region &region) -> bool;
+    //Whether any block checked so far didn't match
+    auto failed() const -> bool;
+
+private:
+
+    auto verifyBlock(int level, size_t block) -> bool;
+
+    const RomFS &romfs;
+    Region master_hash;
+    size_t block_counts[3];
+    bool usable[3]; //False if a level or its hashes aren't entirely inside the image
+    std::vector<std::atomic<u64>> verified[3];
+    std::vector<std::atomic<u64>> mismatched[3];
+    std::atomic<bool> any_failed;
+};
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include "libncsd.h"
+#include "NCSD.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+
+
+struct ncsd_keys {
+    KeyFile keys;
+};
+
+//The image has to stay where it is, the parsed NCSD and NCCHs point back at it
+struct ncsd_image {
+    Image image;
+    std::optional<KeyFile> keys;
+    std::optional<NCSD> ncsd;
+    std::optional<NCCH> ncch;
+    bool decrypted[8] = {};
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+auto fail(ncsd_status status, std::string message) -> ncsd_status {
+    last_error = std::move(message);
+    return status;
+}
+
+//Nothing can be thrown back through the C API, the parsers only throw when they run out of memory
+template<typename Call>
+auto guard(Call call) -> ncsd_status {
+    try {
+        return call();
+    } catch(const std::bad_alloc&) {
+        return fail(NCSD_ERROR_MEMORY, "Out of memory!");
+    } catch(const std::exception &error) {
+        return fail(NCSD_ERROR_FORMAT, error.what());
+    }
+}
+
+//Parses the headers of a freshly loaded image and hands it to the caller
+auto finishOpen(Image loaded, const ncsd_keys *keys, ncsd_image **out) -> ncsd_status {
+    auto image = std::make_unique<ncsd_image>();
+    image->image = std::move(loaded);
+    if(keys != nullptr) {
+        image->keys = keys->keys;
+    }
+
+    const Image &data = image->image;
+    if(data.size() < 0x104) {
+        return fail(NCSD_ERROR_FORMAT, "File is neither an NCSD or NCCH!");
+    }
+
+    const u32 magic = data.data()[0x100] | (data.data()[0x101] << 8) | (data.data()[0x102] << 16) | (u32(data.data()[0x103]) << 24);
+    if(magic == 0x4453434E) {
+        Result<NCSD> ncsd = parseNCSD(data, 0);
+        if(!ncsd) {
+            return fail(NCSD_ERROR_FORMAT, ncsd.error().message);
+        }
+        image->ncsd = std::move(ncsd.value());
+    } else if(magic == 0x4843434E) {
+        Result<NCCH> ncch = parseNCCH(data, 0);
+        if(!ncch) {
+            return fail(NCSD_ERROR_FORMAT, ncch.error().message);
+        }
+        image->ncch = std::move(ncch.value());
+    } else {
+        return fail(NCSD_ERROR_FORMAT, "File is neither an NCSD or NCCH!");
+    }
+
+    *out = image.release();
+    return NCSD_OK;
+}
+
+auto partitionOf(ncsd_image &image, u32 index, const NCCH *&ncch) -> ncsd_status {
+    if(index >= 8) {
+        return fail(NCSD_ERROR_ARGUMENT, "Partition index has to be less than 8!");
+    }
+
+    if(image.ncch.has_value()) {
+        ncch = index == 0 ? &image.ncch.value() : nullptr;
+    } else {
+        const Result<const NCCH*> partition = image.ncsd->partition(static_cast<int>(index));
+        if(!partition) {
+            return fail(NCSD_ERROR_FORMAT, "Partition " + std::to_string(index) + ": " + partition.error().message);
+        }
+        ncch = partition.value();
+    }
+
+    if(ncch == nullptr) {
+        return fail(NCSD_ERROR_NOT_FOUND, "There is no partition " + std::to_string(index) + "!");
+    }
+
+    return NCSD_OK;
+}
+
+//Sections are only read after the partition's metadata has been decrypted in place
+auto decryptedPartition(ncsd_image &image, u32 index, const NCCH *&ncch) -> ncsd_status {
+    const ncsd_status status = partitionOf(image, index, ncch);
+    if(status != NCSD_OK || image.decrypted[index]) {
+        return status;
+    }
+
+    const KeyFile *keys = image.keys ? &image.keys.value() : nullptr;
+    if(isNCCHEncrypted(ncch->header)) {
+        const Result<NCCHKeys> ncch_keys = getNCCHKeys(ncch->header, keys);
+        if(!ncch_keys) {
+            return fail(NCSD_ERROR_CRYPTO, "Partition " + std::to_string(index) + ": " + ncch_keys.error().message);
+        }
+    }
+
+    const Result<void> decrypted = decryptNCCH(image.image, ncch->offset, keys);
+    if(!decrypted) {
+        return fail(NCSD_ERROR_FORMAT, "Partition " + std::to_string(index) + ": " + decrypted.error().message);
+    }
+
+    image.decrypted[index] = true;
+    return NCSD_OK;
+}
+
+} //namespace
+
+int ncsd_api_version(void) {
+    return NCSD_API_VERSION;
+}
+
+const char *ncsd_error(void) {
+    return last_error.c_str();
+}
+
+ncsd_status ncsd_keys_load(const char *path, ncsd_keys **keys) {
+    if(path == nullptr || keys == nullptr) {
+        return fail(NCSD_ERROR_ARGUMENT, "A path and somewhere to put the keys are needed!");
+    }
+
+    return guard([&] {
+        //Bad lines are skipped, there is nowhere to report them that isn't an error
+        std::vector<std::string> warnings;
+        std::optional<KeyFile> loaded = loadKeyFile(path, warnings);
+        if(!loaded.has_value()) {
+            return fail(NCSD_ERROR_IO, std::string("Failed to open key file '") + path + "'!");
+        }
+
+        *keys = new ncsd_keys{std::move(loaded.value())};
+        return NCSD_OK;
+    });
+}
+
+void ncsd_keys_free(ncsd_keys *keys) {
+    delete keys;
+}
+
+ncsd_status ncsd_open_path(const char *path, const ncsd_keys *keys, ncsd_image **image) {
+    if(path == nullptr || image == nullptr) {
+        return fail(NCSD_ERROR_ARGUMENT, "A path and somewhere to put the image are needed!");
+    }
+
+    return guard([&] {
+        std::optional<Image> loaded = Image::open(path);
+        if(!loaded.has_value()) {
+            return fail(NCSD_ERROR_IO, std::string("Failed to open '") + path + "'!");
+        }
+
+        return finishOpen(std::move(loaded.value()), keys, image);
+    });
+}
+
+ncsd_status ncsd_open_fd(int fd, const ncsd_keys *keys, ncsd_image **image) {
+    if(image == nullptr) {
+        return fail(NCSD_ERROR_ARGUMENT, "Somewhere to put the image is needed!");
+    }
+
+    return guard([&] {
+        std::optional<Image> loaded = Image::fromFd(fd);
+        if(!loaded.has_value()) {
+            return fail(NCSD_ERROR_IO, "Failed to map fd " + std::to_string(fd) + "!");
+        }
+
+        return finishOpen(std::move(loaded.value()), keys, image);
+    });
+}
+
+ncsd_status ncsd_open_memory(const void *data, size_t size, const ncsd_keys *keys, ncsd_image **image) {
+    if((data == nullptr && size > 0) || image == nullptr) {
+        return fail(NCSD_ERROR_ARGUMENT, "The data and somewhere to put the image are needed!");
+    }
+
+    return guard([&] {
+        return finishOpen(Image::view(static_cast<const u8*>(data), size), keys, image);
+    });
+}
+
+void ncsd_close(ncsd_image *image) {
+    delete image;
+}
+
+ncsd_format ncsd_image_format(const ncsd_image *image) {
+    if(image == nullptr) {
+        return NCSD_FORMAT_UNKNOWN;
+    }
+
+    return image->ncsd.has_value() ? NCSD_FORMAT_NCSD : NCSD_FORMAT_NCCH;
+}
+
+ncsd_status ncsd_partitions(ncsd_image *image, ncsd_partition *partitions, size_t capacity, size_t *count) {
+    if(image == nullptr || count == nullptr || (partitions == nullptr && capacity > 0)) {
+        return fail(NCSD_ERROR_ARGUMENT, "An image and somewhere to put the count are needed!");
+    }
+
+    return guard([&] {
+        size_t found = 0;
+
+        for(u32 i = 0; i < 8; i++) {
+            if(image->ncsd.has_value() ? !image->ncsd->hasPartition(static_cast<int>(i)) : i > 0) {
+                continue;
+            }
+
+            const NCCH *ncch = nullptr;
+            const ncsd_status status = partitionOf(*image, i, ncch);
+            if(status != NCSD_OK) {
+                return status;
+            }
+
+            if(found < capacity) {
+                const NCCHHeader &header = ncch->header;
+                ncsd_partition &partition = partitions[found];
+                partition = ncsd_partition{i, ncch->offset, u64(header.size) * 0x200, header.partition_id, header.program_id, {},
+                    isNCCHEncrypted(header), header.exefs_size > 0, header.romfs_size > 0};
+                std::memcpy(partition.product_code, header.product_code, sizeof(header.product_code));
+            }
+            found++;
+        }
+
+        *count = found;
+        return NCSD_OK;
+    });
+}
+
+ncsd_status ncsd_lookup(ncsd_image *image, uint32_t partition, const char *path, ncsd_range *range) {
+    if(image == nullptr || path == nullptr || range == nullptr) {
+        return fail(NCSD_ERROR_ARGUMENT, "An image, a path and somewhere to put the range are needed!");
+    }
+
+    if(!decodeUtf8(path).has_value()) {
+        return fail(NCSD_ERROR_ARGUMENT, std::string("The path '") + path + "' isn't valid UTF-8!");
+    }
+
+    return guard([&] {
+        const NCCH *ncch = nullptr;
+        const ncsd_status status = decryptedPartition(*image, partition, ncch);
+        if(status != NCSD_OK) {
+            return status;
+        }
+
+        const Result<std::optional<Region>> found = lookupPath(*ncch, path);
+        if(!found) {
+            return fail(NCSD_ERROR_FORMAT, "Partition " + std::to_string(partition) + ": " + found.error().message);
+        }
+
+        if(!found.value().has_value()) {
+            return fail(NCSD_ERROR_NOT_FOUND, "Partition " + std::to_string(partition) + " has no file '" + path + "'!");
+        }
+
+        *range = ncsd_range{found.value()->offset, found.value()->size};
+        return NCSD_OK;
+    });
+}
+
+ncsd_status ncsd_read(ncsd_image *image, const ncsd_range *range, uint64_t offset, void *buffer, size_t size, size_t *read) {
+    if(image == nullptr || range == nullptr || read == nullptr || (buffer == nullptr && size > 0)) {
+        return fail(NCSD_ERROR_ARGUMENT, "An image, a range, a buffer and somewhere to put the count are needed!");
+    }
+
+    if(!image->image.contains(Region{range->offset, range->size})) {
+        return fail(NCSD_ERROR_ARGUMENT, "The range is outside the image!");
+    }
+
+    const u64 length = offset < range->size ? std::min<u64>(size, range->size - offset) : 0;
+    image->image.read(range->offset + offset, static_cast<u8*>(buffer), length);
+    *read = length;
+    return NCSD_OK;
+}
\ No newline at end of file
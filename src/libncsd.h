@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//libncsd, the NCSD/NCCH/ExeFS/RomFS parsers behind a C API for use in other programs.
+//Images are opened once and then queried in-process, nothing is spawned or reloaded.
+//
+//Every call that can fail returns an ncsd_status, and on failure ncsd_error() has a
+//message saying why. A handle is not thread-safe, but separate handles can be used
+//from separate threads. The API only grows: existing functions, structs and values
+//keep their meaning, and NCSD_API_VERSION goes up when something is added.
+
+#if defined(_WIN32) && defined(NCSD_SHARED)
+    #ifdef NCSD_BUILDING
+        #define NCSD_API __declspec(dllexport)
+    #else
+        #define NCSD_API __declspec(dllimport)
+    #endif
+#elif defined(__GNUC__)
+    #define NCSD_API __attribute__((visibility("default")))
+#else
+    #define NCSD_API
+#endif
+
+#define NCSD_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ncsd_image ncsd_image;
+typedef struct ncsd_keys ncsd_keys;
+
+typedef enum ncsd_status {
+    NCSD_OK = 0,
+    NCSD_ERROR_ARGUMENT = -1,  //A null pointer, a partition index past 7 or a path that isn't UTF-8
+    NCSD_ERROR_IO = -2,        //The file couldn't be opened or mapped
+    NCSD_ERROR_FORMAT = -3,    //Neither an NCSD or NCCH, or a part of it that is needed is invalid
+    NCSD_ERROR_NOT_FOUND = -4, //There is no partition or file by that index or path
+    NCSD_ERROR_CRYPTO = -5,    //The partition is encrypted and the keys are missing or not supported
+    NCSD_ERROR_MEMORY = -6
+} ncsd_status;
+
+typedef enum ncsd_format {
+    NCSD_FORMAT_UNKNOWN = 0, //Only for a null image
+    NCSD_FORMAT_NCSD = 1, //A cart image, with up to 8 partitions
+    NCSD_FORMAT_NCCH = 2  //A single partition on its own, always partition 0
+} ncsd_format;
+
+typedef struct ncsd_partition {
+    uint32_t index;
+    uint64_t offset; //In bytes from the start of the image
+    uint64_t size;   //In bytes
+    uint64_t partition_id;
+    uint64_t program_id;
+    char product_code[17]; //Null terminated
+    int encrypted;
+    int has_exefs;
+    int has_romfs;
+} ncsd_partition;
+
+//A range of the image in bytes. Lookups only return ranges that are inside the image.
+typedef struct ncsd_range {
+    uint64_t offset;
+    uint64_t size;
+} ncsd_range;
+
+NCSD_API int ncsd_api_version(void);
+//The message of the last call that failed on this thread, valid until the next call that fails
+NCSD_API const char *ncsd_error(void);
+
+//A key file of lines like 'slot0x2CKeyX=<hex>' and 'generator=<hex>', needed for encrypted partitions.
+//Lines with a bad key are skipped without failing.
+//The images opened with it take a copy, so it can be freed right after.
+NCSD_API ncsd_status ncsd_keys_load(const char *path, ncsd_keys **keys);
+NCSD_API void ncsd_keys_free(ncsd_keys *keys);
+
+//keys can be null. Only the headers are read when opening, partitions are parsed and
+//decrypted the first time they are looked up in.
+NCSD_API ncsd_status ncsd_open_path(const char *path, const ncsd_keys *keys, ncsd_image **image);
+//The caller keeps ownership of fd, it can be closed once this returns
+NCSD_API ncsd_status ncsd_open_fd(int fd, const ncsd_keys *keys, ncsd_image **image);
+//data isn't copied and has to stay alive until the image is closed, unless it has to be decrypted
+NCSD_API ncsd_status ncsd_open_memory(const void *data, size_t size, const ncsd_keys *keys, ncsd_image **image);
+NCSD_API void ncsd_close(ncsd_image *image);
+
+NCSD_API ncsd_format ncsd_image_format(const ncsd_image *image);
+
+//Fills in up to capacity partitions in index order and sets count to the number there are,
+//so a first call with a capacity of 0 gets the count. Fails if any partition header is invalid.
+NCSD_API ncsd_status ncsd_partitions(ncsd_image *image, ncsd_partition *partitions, size_t capacity, size_t *count);
+
+//Finds a file of a partition by a UTF-8 path, laid out the same way as a dump:
+//'RomFS/dir/file', 'ExeFS/.code', 'logo' or 'plain_region'
+NCSD_API ncsd_status ncsd_lookup(ncsd_image *image, uint32_t partition, const char *path, ncsd_range *range);
+
+//Reads up to size bytes from offset into a range returned by ncsd_lookup, decrypting them
+//if they are encrypted. read is set to how many bytes there were, 0 past the end of the range.
+NCSD_API ncsd_status ncsd_read(ncsd_image *image, const ncsd_range *range, uint64_t offset, void *buffer, size_t size, size_t *read);
+
+#ifdef __cplusplus
+}
+#endif
\ No newline at end of file
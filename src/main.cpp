@@ -1,9 +1,20 @@
 #include "NCSD.hpp"
-#include "Scanner.hpp"
+#include "Image.hpp"
+#include "Dump.hpp"
+#include "ThreadPool.hpp"
+#include "Verify.hpp"
+#include "Scan.hpp"
+#include "Stream.hpp"
+#include "BufferPool.hpp"
+#include "BLZ.hpp"
 #include <fmt/format.h>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -17,14 +28,45 @@ enum NCCHSection : u8 {
     ALL   = 0xF
 };
 
+//Size of each buffer file data is read through with --max-memory
+constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
 struct ProgramConfig {
     bool print = false;
+    bool verify = false;
+    bool verify_reads = false;
+    bool scan = false;
+    bool index = false;
+    bool uring = false;
+    bool decompress_code = false;
     u8 partitions = 0;
+    size_t jobs = 1;
+    size_t max_memory = 0; //In bytes, 0 for no limit
     u8 sections = 0;
-    std::vector<std::string> files;
+    std::vector<std::string> files; //-f and -d paths, checked to be UTF-8 when parsed
     std::vector<std::string> dirs;
-    std::string file_path;
+    std::vector<std::string> file_paths;
+    std::string key_path;
+    std::string catalog_path = "catalog.json";
+    std::string cat_path; //A file to write to stdout instead of dumping
+    u64 cat_offset = 0;
+    std::optional<u64> cat_length; //To the end of the file if not set
+};
+
+//An image and everything its queued dump work points to, which has to stay
+//alive until the group's tasks are done
+struct ImageJob {
+    std::string path;
     std::string dump_dir;
+    std::optional<Image> image;
+    std::optional<NCSD> ncsd;
+    std::optional<NCCH> ncch;
+    std::vector<std::unique_ptr<BlockVerifier>> verifiers;
+    BufferPool *buffers = nullptr; //Set with a memory budget, file data goes through it
+    TaskGroup group;
+    bool verified = true;
+    std::atomic<size_t> dumped_files = 0; //Counted by the writers as they go
+    std::chrono::steady_clock::time_point start;
 };
 
 auto getFileName(std::string_view path) -> std::string {
@@ -42,12 +84,28 @@ auto getFileName(std::string_view path) -> std::string {
 }
 
 void printHelpMessage(const char *name) {
-    printf("Usage: %s [options] <file>\n\n", getFileName(name).c_str());
+    printf("Usage: %s [options] <file>...\n\n", getFileName(name).c_str());
     printf(
     "Options:\n"
     "\t--help     Print this help message\n"
     "\t--version  Print version information\n"
     "\t--print    Print the RomFS filesystem of the partitions\n"
+    "\t--verify   Check the ExHeader, Logo, ExeFS and RomFS (IVFC tree) hashes\n"
+    "\t--verify-reads Check dumped RomFS files against the IVFC tree as they are read\n"
+    "\t--keys F   Key file for encrypted partitions, lines of 'slot0x2CKeyX=<hex>' and 'generator=<hex>'\n"
+    "\t--jobs N   Dump files using N threads, 0 uses all cores (default: 1)\n"
+    "\t--io-uring Write RomFS files with io_uring from a single thread (Linux 5.15+), instead of with --jobs\n"
+    "\t--max-memory MB  Keep the image data held in memory under MB megabytes (at least 4), whatever the image size\n"
+    "\t--list F   Also process the images listed in F, one path per line\n"
+    "\t--scan     Only read the headers of the files and directories given and write a catalog\n"
+    "\t--catalog F  Catalog to write and refresh with --scan (default: catalog.json)\n"
+    "\t--index    Keep parsed RomFS metadata in a '<file>.<partition>.romfs.idx' file next to the image\n"
+    "\t--cat P    Write file P of the partition given with -p (default: 0) to stdout instead of dumping,\n"
+    "\t           P is 'RomFS/<path>', 'ExeFS/<name>', 'logo' or 'plain_region'\n"
+    "\t--range O[:N]  With --cat, only write N bytes from offset O of the file (default: to the end)\n"
+    "\t--decompress-code  Dump ExeFS .code decompressed when the ExHeader says it is compressed\n"
+    "\t-          As a file, read an image from stdin. Pipes and stdin are read in a single pass,\n"
+    "\t           --verify, --verify-reads, --index and --decompress-code need a seekable file\n"
     "\t-a         All, dump all partitions\n"
     "\t-p N       Partition, dump partition N of an NCSD\n"
     "\t-d N       Directory, dump the files in directory named N in the RomFS\n"
@@ -64,13 +122,13 @@ auto parseArgs(int argc, char *argv[]) -> ProgramConfig {
     ProgramConfig config{};
 
     if(argc < 2) {
-        printf("Usage: %s [options] <file>\n\n", getFileName(argv[0]).c_str());
+        printf("Usage: %s [options] <file>...\n\n", getFileName(argv[0]).c_str());
         std::exit(-1);
     }
 
     for(int i = 1; i < argc; i++) {
         std::string arg = argv[i];
-        if(arg[0] == '-') {
+        if(arg[0] == '-' && arg.size() > 1) {
             //Options
             if(arg == "--help") {
                 printHelpMessage(argv[0]);
@@ -83,6 +141,125 @@ auto parseArgs(int argc, char *argv[]) -> ProgramConfig {
 
             if(arg == "--print") {
                 config.print = true;
+            } else if(arg == "--verify") {
+                config.verify = true;
+            } else if(arg == "--verify-reads") {
+                config.verify_reads = true;
+            } else if(arg == "--scan") {
+                config.scan = true;
+            } else if(arg == "--io-uring") {
+                config.uring = true;
+            } else if(arg == "--index") {
+                config.index = true;
+            } else if(arg == "--decompress-code") {
+                config.decompress_code = true;
+            } else if(arg == "--catalog") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--catalog'!\n");
+                    std::exit(-1);
+                }
+
+                config.catalog_path = argv[++i];
+            } else if(arg == "--cat") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--cat'!\n");
+                    std::exit(-1);
+                }
+
+                config.cat_path = argv[++i];
+            } else if(arg == "--range") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--range'!\n");
+                    std::exit(-1);
+                }
+
+                //Decimal or 0x prefixed hex
+                const std::string range = argv[++i];
+                const size_t colon = range.find(':');
+                try {
+                    size_t end = 0;
+                    config.cat_offset = std::stoull(range.substr(0, colon), &end, 0);
+                    if(end != std::min(colon, range.size())) {
+                        throw std::invalid_argument("range");
+                    }
+
+                    if(colon != std::string::npos) {
+                        config.cat_length = std::stoull(range.substr(colon + 1), &end, 0);
+                        if(end != range.size() - colon - 1) {
+                            throw std::invalid_argument("range");
+                        }
+                    }
+                } catch(const std::exception &e) {
+                    printf("Error: Invalid argument provided to '--range'!\n");
+                    std::exit(-1);
+                }
+            } else if(arg == "--keys") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--keys'!\n");
+                    std::exit(-1);
+                }
+
+                config.key_path = argv[++i];
+            } else if(arg == "--list") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--list'!\n");
+                    std::exit(-1);
+                }
+
+                //One path per line
+                std::ifstream list(argv[++i]);
+                if(!list.is_open()) {
+                    printf("Error: Failed to open list file '%s'!\n", argv[i]);
+                    std::exit(-1);
+                }
+
+                std::string line;
+                while(std::getline(list, line)) {
+                    line.erase(line.find_last_not_of(" \t\r") + 1);
+                    if(!line.empty()) {
+                        config.file_paths.push_back(line);
+                    }
+                }
+            } else if(arg == "--jobs") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--jobs'!\n");
+                    std::exit(-1);
+                }
+
+                int num = -1;
+                try {
+                    num = std::stoi(argv[++i]);
+                } catch(const std::exception &e) {
+                    printf("Error: Invalid argument provided to '--jobs'!\n");
+                    std::exit(-1);
+                }
+
+                if(num < 0) {
+                    printf("Error: Invalid argument provided to '--jobs'!\n");
+                    std::exit(-1);
+                }
+
+                config.jobs = num == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : num;
+            } else if(arg == "--max-memory") {
+                if(i == argc - 1) {
+                    printf("Error: No argument provided to option '--max-memory'!\n");
+                    std::exit(-1);
+                }
+
+                int num = -1;
+                try {
+                    num = std::stoi(argv[++i]);
+                } catch(const std::exception &e) {
+                    printf("Error: Invalid argument provided to '--max-memory'!\n");
+                    std::exit(-1);
+                }
+
+                if(num < 4) {
+                    printf("Error: Invalid argument provided to '--max-memory'!\n");
+                    std::exit(-1);
+                }
+
+                config.max_memory = static_cast<size_t>(num) * 1024 * 1024;
             } else if(arg == "-a") {
                 config.partitions |= 0xFF;
             } else if(arg == "-p") {
@@ -108,14 +285,26 @@ auto parseArgs(int argc, char *argv[]) -> ProgramConfig {
                     std::exit(-1);
                 }
 
-                config.dirs.push_back(argv[++i]);
+                //RomFS names are UTF-16, so the path has to convert to be found
+                if(!decodeUtf8(argv[++i]).has_value()) {
+                    printf("Error: The path provided to '-d' isn't valid UTF-8!\n");
+                    std::exit(-1);
+                }
+
+                config.dirs.push_back(argv[i]);
             } else if(arg == "-f") {
                 if(i == argc - 1) {
                     printf("Error: No argument provided to option '-f'!\n");
                     std::exit(-1);
                 }
 
-                config.files.push_back(argv[++i]);
+                //RomFS names are UTF-16, so the path has to convert to be found
+                if(!decodeUtf8(argv[++i]).has_value()) {
+                    printf("Error: The path provided to '-f' isn't valid UTF-8!\n");
+                    std::exit(-1);
+                }
+
+                config.files.push_back(argv[i]);
             } else if(arg == "-s") {
                 config.sections |= ALL;
             } else if(arg == "-r") {
@@ -131,218 +320,590 @@ auto parseArgs(int argc, char *argv[]) -> ProgramConfig {
             }
         } else {
             //File path
-            if(!config.file_path.empty()) {
-                printf("Error: More than one file provided!\n");
-                std::exit(-1);
-            }
-
-            config.file_path = arg;
-            std::string dump_dir = getFileName(config.file_path);
-            config.dump_dir = dump_dir.substr(0, dump_dir.find_last_of('.'));
+            config.file_paths.push_back(arg);
         }
     }
 
     return config;
 }
 
-void printDirectory(const Directory &dir, int level = 0) {
+void printDirectory(const RomFSTree &tree, u32 dir = 0, int level = 0) {
     if(level > 0) {
         fmt::print("{:│>{}}", "├", level);
     }
-    fmt::print("{}\n", std::string(dir.name.begin(), dir.name.end()));
+    const std::u16string_view name = tree.dirName(dir);
+    fmt::print("{}\n", std::string(name.begin(), name.end()));
 
-    for(const auto &child : dir.children) {
-        printDirectory(child, level + 1);
+    for(u32 child = tree.dir_children[dir]; child != RomFSTree::NONE; child = tree.dir_siblings[child]) {
+        printDirectory(tree, child, level + 1);
     }
 
-    for(size_t i = 0; i < dir.files.size(); i++) {
-        if(i < dir.files.size() - 1) {
+    for(u32 file = tree.dir_files[dir]; file != RomFSTree::NONE; file = tree.file_siblings[file]) {
+        if(tree.file_siblings[file] != RomFSTree::NONE) {
             fmt::print("{:│>{}}", "├", level + 1);
         } else {
             fmt::print("{:│>{}}", "└", level + 1);
         }
 
-        fmt::print("{}\n", std::string(dir.files[i].name.begin(), dir.files[i].name.end()));
+        const std::u16string_view file_name = tree.fileName(file);
+        fmt::print("{}\n", std::string(file_name.begin(), file_name.end()));
     }
 }
 
-void dumpFile(const File &file, const std::vector<u8> &file_data, const std::u16string &parent) {
-    const std::filesystem::path file_path = parent + file.name;
-    std::ofstream file_stream(file_path, std::ios::binary);
+auto verify(const NCCH &ncch, ThreadPool *pool) -> bool {
+    std::vector<HashCheck> checks = collectHashChecks(ncch);
+    const bool passed = runHashChecks(*ncch.image, checks, pool);
 
-    if(!file_stream.is_open()) {
-        printf("Failed to dump file '%s'\n", file_path.string().c_str());
-        return;
+    for(const auto &check : checks) {
+        printf("%-16s %s\n", check.name.c_str(), check.passed ? "OK" : "FAILED");
     }
 
-    file_stream.write(reinterpret_cast<const char*>(&file_data[file.offset]), file.size);
-}
-
-void dumpDirectory(const Directory &dir, const std::vector<u8> &file_data, const std::u16string &parent_path) {
-    const std::u16string new_path = parent_path + dir.name + u'/';
-    std::filesystem::create_directory(new_path);
-
-    for(const auto &child : dir.children) {
-        dumpDirectory(child, file_data, new_path);
+    const Result<const RomFS*> parsed = ncch.romfs();
+    if(!parsed) {
+        printf("%-16s %s\n", "RomFS IVFC", "FAILED");
+        printf("  %s\n", parsed.error().message.c_str());
+        return false;
     }
 
-    for(const auto &file : dir.files) {
-        dumpFile(file, file_data, new_path);
+    const RomFS *romfs = parsed.value();
+    if(romfs == nullptr) {
+        return passed;
     }
-}
 
-auto findFile(const Directory &search_dir, const std::u16string &search_path, const std::u16string &path) -> std::optional<const File*> {
-    std::u16string new_search_path = search_path + search_dir.name + u'/';
+    const std::vector<IVFCFailure> failures = verifyIVFC(*romfs, pool);
+    printf("%-16s %s\n", "RomFS IVFC", failures.empty() ? "OK" : "FAILED");
+
+    //A single bad level 1 block would otherwise list thousands of level 3 blocks below it
+    constexpr size_t MAX_REPORTED = 32;
+    for(size_t i = 0; i < failures.size() && i < MAX_REPORTED; i++) {
+        const IVFCFailure &failure = failures[i];
+        const IVFCLevel &level = romfs->levels[failure.level - 1];
+        printf("  Level %i block %zu (offset 0x%zX)\n", failure.level, failure.block, level.data.offset + failure.block * level.block_size);
 
-    for(const auto &file : search_dir.files) {
-        if((new_search_path + file.name) == path) {
-            return {&file};
+        if(failure.level == 3) {
+            for(u32 file : filesInBlock(*romfs, failure.block)) {
+                printf("    %s\n", std::filesystem::path(romfs->tree.filePath(file)).string().c_str());
+            }
         }
     }
 
-    for(const auto &child : search_dir.children) {
-        std::optional<const File*> result = findFile(child, new_search_path, path);
-        if(result.has_value()) {
-            return result;
-        }
+    if(failures.size() > MAX_REPORTED) {
+        printf("  ... and %zu more\n", failures.size() - MAX_REPORTED);
     }
 
-    return {};
+    return passed && failures.empty();
 }
 
-auto findDirectory(const Directory &search_dir, const std::u16string &search_path, const std::u16string &path) -> std::optional<const Directory*> {
-    std::u16string new_search_path = search_path + search_dir.name;
+//Writes .code decompressed, or as it is stored if it doesn't decompress. The whole of it is held
+//in memory. With a budget the half that isn't buffers for file data also covers the metadata and
+//the pages being read, so .code only gets half of that.
+void dumpCode(const std::string &path, const Image &image, const Region &region, size_t max_memory, BufferPool *buffers) {
+    u8 footer[8] = {};
+    if(region.size >= sizeof(footer)) {
+        image.read(region.offset + region.size - sizeof(footer), footer, sizeof(footer));
+    }
 
-    if(new_search_path == path) {
-        return {&search_dir};
+    const Result<size_t> decompressed_size = decompressedSizeBLZ(region.size, footer);
+    if(!decompressed_size) {
+        printf("Warning: %s Dumping .code as it is stored\n", decompressed_size.error().message.c_str());
+        dumpRegion(path, image, region, buffers);
+        return;
+    }
+
+    if(max_memory > 0 && decompressed_size.value() > max_memory / 4) {
+        printf("Warning: Decompressing .code needs %zu MB, more than --max-memory leaves for it. Dumping .code as it is stored\n",
+            (decompressed_size.value() + 1024 * 1024 - 1) / (1024 * 1024));
+        dumpRegion(path, image, region, buffers);
+        return;
     }
 
-    new_search_path += u'/';
+    std::vector<u8> code;
+    code.reserve(decompressed_size.value());
+    code.resize(region.size);
+    image.read(region.offset, code.data(), code.size());
+    image.release(region.offset, region.size);
 
-    for(const auto &child : search_dir.children) {
-        std::optional<const Directory*> result = findDirectory(child, new_search_path, path);
-        if(result.has_value()) {
-            return result;
-        }
+    const Result<void> decompressed = decompressBLZ(code);
+    if(!decompressed) {
+        printf("Warning: %s Dumping .code as it is stored\n", decompressed.error().message.c_str());
+        dumpRegion(path, image, region, buffers);
+        return;
     }
 
-    return {};
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file.write(reinterpret_cast<const char*>(code.data()), code.size())) {
+        printf("Error: Failed to dump file '%s'\n", path.c_str());
+    }
 }
 
-void dump(const ProgramConfig &config, const NCCH &ncch, int partition = 0) {
-    std::string partition_dir = config.dump_dir + '/' + std::to_string(partition) + '/';
+//With a pool the RomFS is dumped in the background, wait for the job's group before using the results.
+//Returns false if a section to dump is invalid.
+auto dump(const ProgramConfig &config, ImageJob &job, const NCCH &ncch, ThreadPool *pool, int partition = 0) -> bool {
+    const Image &image = *ncch.image;
+    std::string partition_dir = job.dump_dir + '/' + std::to_string(partition) + '/';
     std::filesystem::create_directories(partition_dir);
 
     //Dump ExeFS
-    if(config.sections & EXEFS && ncch.exefs.has_value()) {
+    const Result<const ExeFS*> exefs = config.sections & EXEFS ? ncch.exefs() : nullptr;
+    if(!exefs) {
+        printf("Error: %s\n", exefs.error().message.c_str());
+        return false;
+    }
+
+    if(exefs.value() != nullptr) {
         std::string exefs_dir = partition_dir + "ExeFS/";
         std::filesystem::create_directory(exefs_dir);
+        const bool decompress_code = config.decompress_code && isCodeCompressed(ncch);
 
         for(int i = 0; i < 10; i++) {
-            if(ncch.exefs->header.file_headers[i].size > 0) {
+            if(exefs.value()->header.file_headers[i].size > 0) {
                 char name[9] = {0};
-                std::memcpy(name, ncch.exefs->header.file_headers[i].name, sizeof(ExeFSFileHeader::name));
+                std::memcpy(name, exefs.value()->header.file_headers[i].name, sizeof(ExeFSFileHeader::name));
 
-                std::ofstream file(exefs_dir + name, std::ios::binary);
-                file.write(reinterpret_cast<const char*>(ncch.exefs->file_data[i].data()), ncch.exefs->file_data[i].size());
+                if(decompress_code && std::strcmp(name, ".code") == 0) {
+                    dumpCode(exefs_dir + name, image, exefs.value()->file_data[i], config.max_memory, job.buffers);
+                } else {
+                    dumpRegion(exefs_dir + name, image, exefs.value()->file_data[i], job.buffers);
+                }
             }
         }
     }
 
     //Dump Logo
     if(config.sections & LOGO && ncch.logo.has_value()) {
-        std::ofstream file(partition_dir + "logo", std::ios::binary);
-        file.write(reinterpret_cast<const char*>(ncch.logo->data()), ncch.logo->size());
+        dumpRegion(partition_dir + "logo", image, ncch.logo.value(), job.buffers);
     }
 
     //Dump Plain Region
     if(config.sections & PLAIN && ncch.plain_region.has_value()) {
-        std::ofstream file(partition_dir + "plain_region", std::ios::binary);
-        file.write(reinterpret_cast<const char*>(ncch.plain_region->data()), ncch.plain_region->size());
+        dumpRegion(partition_dir + "plain_region", image, ncch.plain_region.value(), job.buffers);
     }
 
     //Dump whole RomFS, or the specified files/directories
-    if(config.sections & ROMFS && ncch.romfs.has_value()) {
-        dumpDirectory(ncch.romfs->root, ncch.romfs->level3.file_data, std::u16string(partition_dir.begin(), partition_dir.end()));
-    } else if((!config.files.empty() || !config.dirs.empty()) && ncch.romfs.has_value()) {
-        const std::string romfs_dir = partition_dir + "RomFS/";
+    const bool dump_romfs = config.sections & ROMFS || !config.files.empty() || !config.dirs.empty();
+    const Result<const RomFS*> parsed = dump_romfs ? ncch.romfs() : nullptr;
+    if(!parsed) {
+        printf("Error: %s\n", parsed.error().message.c_str());
+        return false;
+    }
+
+    const RomFS *romfs = parsed.value();
+    if(romfs == nullptr) {
+        return true;
+    }
+
+    BlockVerifier *verifier = nullptr;
+    if(config.verify_reads) {
+        job.verifiers.push_back(std::make_unique<BlockVerifier>(*romfs));
+        verifier = job.verifiers.back().get();
+    }
+
+    const DumpContext context{&image, &romfs->tree, romfs->level3.file_data, pool, &job.group, verifier, config.uring, job.buffers, &job.dumped_files};
+
+    DumpPlan plan{partition_dir, {}, {}};
+    if(config.sections & ROMFS) {
+        image.advise(context.file_data.offset, context.file_data.size, Image::Access::Sequential);
+        planDirectory(context, 0, RomFSTree::NONE, plan);
+    } else {
         for(const auto &file_path : config.files) {
-            std::string abs_file_path = std::string("RomFS/") + file_path;
-            std::optional<const File*> result = findFile(ncch.romfs->root, u"", std::u16string(abs_file_path.begin(), abs_file_path.end()));
+            std::optional<u32> result = lookupFile(*romfs, decodeUtf8(file_path).value());
             if(result.has_value()) {
-                std::filesystem::path parent_dir = std::filesystem::path(romfs_dir + file_path).parent_path();
-                std::filesystem::create_directories(parent_dir);
-                dumpFile(*result.value(), ncch.romfs->level3.file_data, parent_dir.u16string() + u'/');
+                const u32 parent = planPath(plan, std::filesystem::path("RomFS/" + file_path).parent_path());
+                planFile(context, result.value(), parent, plan);
             }
         }
 
         for(const auto &dir_path : config.dirs) {
-            std::string abs_dir_path = std::string("RomFS/") + dir_path;
-            std::optional<const Directory*> result = findDirectory(ncch.romfs->root, u"", std::u16string(abs_dir_path.begin(), abs_dir_path.end()));
+            std::optional<u32> result = lookupDirectory(*romfs, decodeUtf8(dir_path).value());
             if(result.has_value()) {
-                std::filesystem::path parent_dir = std::filesystem::path(romfs_dir + dir_path).parent_path();
-                std::filesystem::create_directories(parent_dir);
-                dumpDirectory(*result.value(), ncch.romfs->level3.file_data, parent_dir.u16string() + u'/');
+                const u32 parent = planPath(plan, std::filesystem::path("RomFS/" + dir_path).parent_path());
+                planDirectory(context, result.value(), parent, plan);
             }
         }
     }
+
+    const Result<void> dumped = dumpPlan(context, std::move(plan));
+    if(!dumped) {
+        printf("Error: %s\n", dumped.error().message.c_str());
+        return false;
+    }
+
+    return true;
 }
 
-int main(int argc, char *argv[]) {
-    ProgramConfig config = parseArgs(argc, argv);
-    if(config.file_path.empty()) {
-        printf("Error: No file path provided!\n");
-        return -1;
+//Fills the partition's RomFS cache from its sidecar index, or parses it and writes the index
+void indexRomFS(const ProgramConfig &config, const ImageJob &job, const NCCH &ncch, int partition = 0) {
+    const bool needs_romfs = config.print || config.verify || config.sections & ROMFS || !config.files.empty() || !config.dirs.empty();
+    if(!config.index || !needs_romfs) {
+        return;
+    }
+
+    std::error_code error;
+    const u64 size = std::filesystem::file_size(job.path, error);
+    const auto mtime = std::filesystem::last_write_time(job.path, error);
+    if(error) {
+        return;
+    }
+
+    const RomFSIndexKey key{size, static_cast<s64>(mtime.time_since_epoch().count())};
+    std::vector<std::string> warnings;
+    ncch.romfs(fmt::format("{}.{}.romfs.idx", job.path, partition), key, warnings);
+    for(const std::string &warning : warnings) {
+        printf("Warning: %s\n", warning.c_str());
+    }
+}
+
+//Pipes and stdin can only be read once from front to back
+auto isStream(const std::string &path) -> bool {
+    if(path == "-") {
+        return true;
     }
 
-    std::ifstream file(config.file_path, std::ios::binary);
-    if(!file.is_open()) {
+    std::error_code error;
+    const std::filesystem::file_type type = std::filesystem::status(path, error).type();
+    return !error && (type == std::filesystem::file_type::fifo || type == std::filesystem::file_type::character);
+}
+
+auto streamOptions(const ProgramConfig &config, const KeyFile *keys) -> StreamOptions {
+    StreamOptions options{config.partitions, (config.sections & ROMFS) != 0, (config.sections & EXEFS) != 0, (config.sections & LOGO) != 0,
+        (config.sections & PLAIN) != 0, config.files, config.dirs, keys, {}};
+
+    if(config.print) {
+        options.print = [](const RomFSTree &tree) { printDirectory(tree); };
+    }
+
+    return options;
+}
+
+//Parses, prints, verifies and starts dumping an image. Returns false if it couldn't be processed at all.
+auto processImage(const ProgramConfig &config, ImageJob &job, const KeyFile *keys, ThreadPool *pool) -> bool {
+    job.start = std::chrono::steady_clock::now();
+    job.image = Image::open(job.path);
+    if(!job.image.has_value()) {
         printf("Error: Failed to open file!\n");
-        return -1;
+        return false;
     }
 
-    size_t size = std::filesystem::file_size(config.file_path);
-    std::vector<u8> data(size);
-    file.read(reinterpret_cast<char*>(data.data()), size);
-    file.close();
+    Image &image = job.image.value();
+    image.setBounded(job.buffers != nullptr);
+    if(image.size() < 0x104) {
+        printf("Error: File is neither an NCSD or NCCH!\n");
+        return false;
+    }
 
     //Determine if file is NCSD or an NCCH partition, or neither
+    const u8 *data = image.data();
     u32 magic = data[0x100] | (data[0x101] << 8) | (data[0x102] << 16) | (data[0x103] << 24);
-    std::vector<NCCH> ncchs;
 
     //Create dump directory
     if(config.sections != 0) {
-        std::filesystem::create_directory(config.dump_dir);
+        std::filesystem::create_directory(job.dump_dir);
     }
-    
+
+    bool processed = true;
     if(magic == 0x4453434E) {
         printf("NCSD\n");
 
         //Print some information about NCSD if necessary
-        NCSD ncsd = parseNCSD(data, 0);
+        Result<NCSD> parsed = parseNCSD(image, 0);
+        if(!parsed) {
+            printf("Error: %s\n", parsed.error().message.c_str());
+            return false;
+        }
+        const NCSD &ncsd = job.ncsd.emplace(std::move(parsed.value()));
 
-        //Add all partitions specified by config
+        //Add all partitions specified by config, a bad one doesn't stop the others
         for(int i = 0; i < 8; i++) {
-            if(config.partitions & (1 << i) && ncsd.partitions[i].has_value()) {
-                if(config.print && ncsd.partitions[i]->romfs.has_value()) {
+            const Result<const NCCH*> partition = config.partitions & (1 << i) ? ncsd.partition(i) : nullptr;
+            if(!partition) {
+                printf("Error: Partition %i: %s\n", i, partition.error().message.c_str());
+                processed = false;
+                continue;
+            }
+
+            const NCCH *ncch = partition.value();
+            if(ncch != nullptr) {
+                const Result<void> decrypted = decryptNCCH(image, ncch->offset, keys);
+                if(!decrypted) {
+                    printf("Error: %s\n", decrypted.error().message.c_str());
+                    printf("Error: Failed to decrypt partition %i!\n", i);
+                    processed = false;
+                    continue;
+                }
+
+                indexRomFS(config, job, *ncch, i);
+                const Result<const RomFS*> romfs = config.print ? ncch->romfs() : nullptr;
+                if(!romfs) {
+                    printf("Error: Partition %i: %s\n", i, romfs.error().message.c_str());
+                    processed = false;
+                    continue;
+                }
+
+                if(romfs.value() != nullptr) {
                     printf("Partition %i:\n", i);
-                    printDirectory(ncsd.partitions[i]->romfs->root);
+                    printDirectory(romfs.value()->tree);
+                }
+
+                if(config.verify) {
+                    printf("Partition %i hashes:\n", i);
+                    job.verified &= verify(*ncch, pool);
                 }
 
-                dump(config, ncsd.partitions[i].value(), i);
+                processed &= dump(config, job, *ncch, pool, i);
             }
         }
     } else if(magic == 0x4843434E) {
         printf("NCCH\n");
-        NCCH ncch = parseNCCH(data, 0);
+        Result<NCCH> parsed = parseNCCH(image, 0);
+        if(!parsed) {
+            printf("Error: %s\n", parsed.error().message.c_str());
+            return false;
+        }
+
+        const NCCH &ncch = job.ncch.emplace(std::move(parsed.value()));
+        const Result<void> decrypted = decryptNCCH(image, 0, keys);
+        if(!decrypted) {
+            printf("Error: %s\n", decrypted.error().message.c_str());
+            return false;
+        }
+
+        indexRomFS(config, job, ncch);
+        const Result<const RomFS*> romfs = config.print ? ncch.romfs() : nullptr;
+        if(!romfs) {
+            printf("Error: %s\n", romfs.error().message.c_str());
+            return false;
+        }
+
+        if(romfs.value() != nullptr) {
+            printDirectory(romfs.value()->tree);
+        }
 
-        if(config.print && ncch.romfs.has_value()) {
-            printDirectory(ncch.romfs->root);
+        if(config.verify) {
+            job.verified &= verify(ncch, pool);
         }
 
-        dump(config, ncch);
+        processed = dump(config, job, ncch, pool);
     } else {
         printf("Error: File is neither an NCSD or NCCH!\n");
+        return false;
+    }
+
+    return processed;
+}
+
+//Writes a file of an image, or a range of it, to stdout. Only the file's data goes to stdout
+//so it can be piped, errors go to stderr.
+auto catFile(const ProgramConfig &config, const std::string &path, const KeyFile *keys) -> bool {
+    if(isStream(path)) {
+        fprintf(stderr, "Error: '%s' can only be read once, --cat needs a seekable file!\n", path.c_str());
+        return false;
+    }
+
+    std::optional<Image> opened = Image::open(path);
+    if(!opened.has_value()) {
+        fprintf(stderr, "Error: Failed to open file!\n");
+        return false;
+    }
+
+    Image &image = opened.value();
+    if(image.size() < 0x104) {
+        fprintf(stderr, "Error: File is neither an NCSD or NCCH!\n");
+        return false;
+    }
+
+    //The lowest partition given with -p
+    int partition = 0;
+    while(partition < 7 && config.partitions != 0 && !(config.partitions & (1 << partition))) {
+        partition++;
+    }
+
+    const u8 *data = image.data();
+    u32 magic = data[0x100] | (data[0x101] << 8) | (data[0x102] << 16) | (data[0x103] << 24);
+
+    std::optional<NCSD> ncsd;
+    std::optional<NCCH> single;
+    const NCCH *ncch = nullptr;
+    if(magic == 0x4453434E) {
+        Result<NCSD> parsed = parseNCSD(image, 0);
+        if(!parsed) {
+            fprintf(stderr, "Error: %s\n", parsed.error().message.c_str());
+            return false;
+        }
+
+        const Result<const NCCH*> found = ncsd.emplace(std::move(parsed.value())).partition(partition);
+        if(!found) {
+            fprintf(stderr, "Error: Partition %i: %s\n", partition, found.error().message.c_str());
+            return false;
+        }
+        ncch = found.value();
+    } else if(magic == 0x4843434E) {
+        Result<NCCH> parsed = parseNCCH(image, 0);
+        if(!parsed) {
+            fprintf(stderr, "Error: %s\n", parsed.error().message.c_str());
+            return false;
+        }
+
+        if(partition == 0) {
+            ncch = &single.emplace(std::move(parsed.value()));
+        }
+    } else {
+        fprintf(stderr, "Error: File is neither an NCSD or NCCH!\n");
+        return false;
+    }
+
+    if(ncch == nullptr) {
+        fprintf(stderr, "Error: There is no partition %i!\n", partition);
+        return false;
+    }
+
+    const Result<void> decrypted = decryptNCCH(image, ncch->offset, keys);
+    if(!decrypted) {
+        fprintf(stderr, "Error: %s\n", decrypted.error().message.c_str());
+        return false;
+    }
+
+    const Result<std::optional<Region>> found = lookupPath(*ncch, config.cat_path);
+    if(!found) {
+        fprintf(stderr, "Error: %s\n", found.error().message.c_str());
+        return false;
+    }
+
+    if(!found.value().has_value()) {
+        fprintf(stderr, "Error: Partition %i has no file '%s'!\n", partition, config.cat_path.c_str());
+        return false;
+    }
+
+    //A range past the end of the file is cut short like a read would be
+    const Region &file = found.value().value();
+    const u64 offset = std::min<u64>(config.cat_offset, file.size);
+    const u64 length = std::min<u64>(config.cat_length.value_or(file.size), file.size - offset);
+    if(!dumpRegionToStdout(image, Region{file.offset + offset, length})) {
+        fprintf(stderr, "Error: Failed to write to stdout!\n");
+        return false;
+    }
+
+    return true;
+}
+
+//Waits for the image's queued work, returns false if any of it failed verification
+auto finishImage(ImageJob &job, ThreadPool *pool) -> bool {
+    if(pool != nullptr) {
+        job.group.wait();
+    }
+
+    for(const auto &verifier : job.verifiers) {
+        job.verified &= !verifier->failed();
+    }
+
+    //Includes parsing the image, so the writers can be compared on the same terms
+    const size_t dumped_files = job.dumped_files;
+    if(dumped_files > 0) {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.start).count();
+        printf("Dumped %zu RomFS files in %.3f s (%.0f files/s)\n", dumped_files, seconds, dumped_files / seconds);
+    }
+
+    return job.verified;
+}
+
+int main(int argc, char *argv[]) {
+    ProgramConfig config = parseArgs(argc, argv);
+    if(config.file_paths.empty()) {
+        printf("Error: No file path provided!\n");
+        return -1;
+    }
+
+    std::optional<KeyFile> keys;
+    if(!config.key_path.empty()) {
+        //With --cat stdout is the file being written
+        FILE *messages = config.cat_path.empty() ? stdout : stderr;
+        std::vector<std::string> warnings;
+        keys = loadKeyFile(config.key_path, warnings);
+        for(const std::string &warning : warnings) {
+            fprintf(messages, "Warning: %s\n", warning.c_str());
+        }
+
+        if(!keys.has_value()) {
+            fprintf(messages, "Error: Failed to open key file!\n");
+            return -1;
+        }
+    }
+
+    if(!config.cat_path.empty()) {
+        if(config.file_paths.size() > 1) {
+            fprintf(stderr, "Warning: --cat only reads the first file given\n");
+        }
+
+        return catFile(config, config.file_paths.front(), keys ? &keys.value() : nullptr) ? 0 : -1;
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if(config.jobs > 1) {
+        pool = std::make_unique<ThreadPool>(config.jobs);
+    }
+
+    //Half of the budget is buffers for file data, the rest covers the metadata
+    //and the pages of the image being worked on at any one time
+    std::unique_ptr<BufferPool> buffers;
+    if(config.max_memory > 0) {
+        buffers = std::make_unique<BufferPool>(BUFFER_SIZE, config.max_memory / 2 / BUFFER_SIZE);
+    }
+
+    if(config.scan) {
+        return scanImages(config.file_paths, config.catalog_path, keys ? &keys.value() : nullptr, pool.get()) ? 0 : -1;
+    }
+
+    //Images are parsed one after another while the dumps of the previous ones run
+    //on the pool. Only a few are kept in flight so memory use stays bounded.
+    const size_t max_in_flight = pool != nullptr ? pool->size() + 1 : 1;
+    std::deque<std::unique_ptr<ImageJob>> in_flight;
+    std::map<std::string, int> dump_dirs;
+    bool processed = true;
+    bool verified = true;
+
+    for(const auto &path : config.file_paths) {
+        auto job = std::make_unique<ImageJob>();
+        job->path = path;
+        job->buffers = buffers.get();
+
+        //Dump into a directory named after the file, numbered if several files have the same name
+        const std::string file_name = path == "-" ? "stdin" : getFileName(path);
+        job->dump_dir = file_name.substr(0, file_name.find_last_of('.'));
+        const int count = dump_dirs[job->dump_dir]++;
+        if(count > 0) {
+            job->dump_dir += '_' + std::to_string(count + 1);
+        }
+
+        if(config.file_paths.size() > 1) {
+            printf("%s:\n", path.c_str());
+        }
+
+        if(isStream(path)) {
+            if(config.verify || config.verify_reads || config.index || config.decompress_code) {
+                printf("Warning: '%s' can only be read once, --verify, --verify-reads, --index and --decompress-code are ignored\n", path.c_str());
+            }
+
+            processed &= streamImage(path, job->dump_dir, streamOptions(config, keys ? &keys.value() : nullptr));
+            continue;
+        }
+
+        processed &= processImage(config, *job, keys ? &keys.value() : nullptr, pool.get());
+        in_flight.push_back(std::move(job));
+
+        while(in_flight.size() >= max_in_flight) {
+            verified &= finishImage(*in_flight.front(), pool.get());
+            in_flight.pop_front();
+        }
+    }
+
+    while(!in_flight.empty()) {
+        verified &= finishImage(*in_flight.front(), pool.get());
+        in_flight.pop_front();
+    }
+
+    if(!verified) {
+        printf("Error: Hash verification failed!\n");
         return -1;
     }
+
+    return processed ? 0 : -1;
 }
\ No newline at end of file
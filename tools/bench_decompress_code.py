@@ -0,0 +1,184 @@
+# Times dumping a BLZ compressed .code with and without --decompress-code, and checks the result.
+# The .code is made up, compressed here and put in an image with make_test_image.py. A plain Python
+# decoder, the way scripts outside the tool decompress .code, is timed on the same data to compare.
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+import make_test_image
+
+
+RUNS = 5
+MIN_DISTANCE = 3
+MAX_DISTANCE = 0x1002
+MAX_LENGTH = 18
+
+def make_code(size):
+    # Instruction-like words, with some runs repeated the way code and data repeat
+    generator = random.Random(1)
+    words = [generator.getrandbits(32) for _ in range(512)]
+    code = bytearray()
+    while len(code) < size:
+        if code and generator.random() < 0.3:
+            start = generator.randrange(max(1, len(code) - 0x1000), len(code))
+            code += code[start:start + generator.randrange(4, 64)]
+        else:
+            code += struct.pack("<I", generator.choice(words))
+    return bytes(code[:size])
+
+def find_tokens(data):
+    # Greedy matches over the data read backwards, literals are single bytes
+    chains = {}
+    tokens = []
+    position = 0
+    while position < len(data):
+        best_length, best_distance = 0, 0
+        for candidate in reversed(chains.get(data[position:position + 3], [])[-16:]):
+            distance = position - candidate
+            if distance > MAX_DISTANCE:
+                break
+            if distance < MIN_DISTANCE:
+                continue
+
+            length = 0
+            while length < MAX_LENGTH and position + length < len(data) and data[candidate + length] == data[position + length]:
+                length += 1
+            if length > best_length:
+                best_length, best_distance = length, distance
+
+        step = best_length if best_length >= 3 else 1
+        for i in range(position, position + step):
+            chains.setdefault(data[i:i + 3], []).append(i)
+        tokens.append((best_length, best_distance) if best_length >= 3 else data[position])
+        position += step
+    return tokens
+
+def encode(data):
+    stream = bytearray()
+    tokens = find_tokens(data[::-1])
+    for group in range(0, len(tokens), 8):
+        flags = 0
+        payload = bytearray()
+        for i, token in enumerate(tokens[group:group + 8]):
+            if isinstance(token, tuple):
+                flags |= 0x80 >> i
+                value = ((token[0] - 3) << 12) | (token[1] - 3)
+                payload += bytes([value >> 8, value & 0xFF])
+            else:
+                payload.append(token)
+        stream.append(flags)
+        stream += payload
+    return bytes(stream[::-1])
+
+def fits_in_place(data):
+    # Decoding in place overwrites the stream behind it, check no token writes over input not read yet
+    bounds, extra_size = struct.unpack_from("<II", data, len(data) - 8)
+    stop = len(data) - (bounds & 0xFFFFFF)
+    position = len(data) - (bounds >> 24)
+    output = len(data) + extra_size
+    while position > stop:
+        position -= 1
+        flags = data[position]
+        for _ in range(8):
+            if position <= stop:
+                break
+            if flags & 0x80:
+                position -= 2
+                output -= (((data[position] | (data[position + 1] << 8)) >> 12) + 3)
+                if output < position:
+                    return False
+            else:
+                position -= 1
+                output -= 1
+            flags = (flags << 1) & 0xFF
+    return True
+
+def compress(data):
+    # Anything the stream would overwrite too early is left uncompressed at the start
+    stored = 0
+    while True:
+        stream = encode(data[stored:])
+        padding = (-(stored + len(stream))) % 4
+        compressed_size = len(stream) + padding + 8
+        footer = struct.pack("<II", ((padding + 8) << 24) | compressed_size, len(data) - stored - compressed_size)
+        result = data[:stored] + stream + b"\xFF" * padding + footer
+        if fits_in_place(result):
+            return result
+        stored += max(len(data) // 64, 0x100)
+
+def decompress(data):
+    bounds, extra_size = struct.unpack_from("<II", data, len(data) - 8)
+    stop = len(data) - (bounds & 0xFFFFFF)
+    position = len(data) - (bounds >> 24)
+    output = bytearray(data) + bytes(extra_size)
+    end = len(output)
+    while position > stop:
+        position -= 1
+        flags = data[position]
+        for _ in range(8):
+            if position <= stop:
+                break
+            if flags & 0x80:
+                position -= 2
+                value = data[position] | (data[position + 1] << 8)
+                for _ in range((value >> 12) + 3):
+                    end -= 1
+                    output[end] = output[end + (value & 0xFFF) + 3]
+            else:
+                position -= 1
+                end -= 1
+                output[end] = data[position]
+            flags = (flags << 1) & 0xFF
+    return bytes(output)
+
+def best_time(function):
+    best = None
+    for _ in range(RUNS):
+        start = time.perf_counter()
+        function()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: bench_decompress_code.py <tool> [.code size in KB]")
+        exit(0)
+
+    tool = os.path.abspath(sys.argv[1])
+    code = make_code((int(sys.argv[2]) if len(sys.argv) > 2 else 2048) * 1024)
+    compressed = compress(code)
+    print("{} bytes of .code compressed to {}".format(len(code), len(compressed)))
+
+    with tempfile.TemporaryDirectory() as directory:
+        image = os.path.join(directory, "code.cxi")
+        with open(image, "wb") as image_file:
+            image_file.write(make_test_image.build_ncch({}, compressed, True, 0x0004000000123400))
+
+        def dump(*options):
+            subprocess.run([tool, "-e", *options, image], cwd=directory, stdout=subprocess.DEVNULL, check=True)
+
+        stored = best_time(lambda: dump())
+        decompressed = best_time(lambda: dump("--decompress-code"))
+        with open(os.path.join(directory, "code", "0", "ExeFS", ".code"), "rb") as code_file:
+            if code_file.read() != code:
+                print("Error: --decompress-code didn't give back the original .code!")
+                exit(-1)
+
+        start = time.perf_counter()
+        if decompress(compressed) != code:
+            print("Error: the Python decoder didn't give back the original .code!")
+            exit(-1)
+        script = time.perf_counter() - start
+
+    print("{:<28}{:>10.1f} ms".format("-e", stored * 1000))
+    print("{:<28}{:>10.1f} ms".format("-e --decompress-code", decompressed * 1000))
+    print("{:<28}{:>10.1f} ms".format("Python decoder", script * 1000))
+
+
+if __name__ == "__main__":
+    main()
\ No newline at end of file
@@ -0,0 +1,46 @@
+# Times how long the tool takes to parse RomFS trees of growing size, to check that parsing stays linear.
+# Each image is made with make_test_image.py, and only a single file is written so the parse is what is timed.
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+RUNS = 5
+COUNTS = [10000, 50000, 200000, 500000]
+
+def time_parse(tool, image):
+    best = None
+    for _ in range(RUNS):
+        start = time.perf_counter()
+        subprocess.run([tool, "-f", "dir00000/file0000000.bin", image], cwd=os.path.dirname(image), stdout=subprocess.DEVNULL, check=True)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: bench_romfs_parse.py <tool> [other tool to compare] [file counts...]")
+        exit(0)
+
+    tools = [os.path.abspath(arg) for arg in sys.argv[1:] if not arg.isdigit()]
+    counts = [int(arg) for arg in sys.argv[1:] if arg.isdigit()] or COUNTS
+    generator = os.path.join(os.path.dirname(os.path.abspath(__file__)), "make_test_image.py")
+
+    print("{:>10}".format("files") + "".join("{:>24}".format(os.path.basename(tool)) for tool in tools))
+    with tempfile.TemporaryDirectory() as directory:
+        for count in counts:
+            image = os.path.join(directory, "romfs_{}.cxi".format(count))
+            subprocess.run([sys.executable, generator, image, str(count), "0"], check=True)
+
+            row = "{:>10}".format(count)
+            for tool in tools:
+                elapsed = time_parse(tool, image)
+                row += "{:>12.1f} ms {:>6.3f} us/f".format(elapsed * 1000, elapsed * 1e6 / count)
+            print(row)
+            os.remove(image)
+
+
+if __name__ == "__main__":
+    main()
\ No newline at end of file
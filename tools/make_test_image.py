@@ -0,0 +1,212 @@
+# Writes a synthetic, unencrypted NCCH (.cxi) or NCSD (.3ds) image for testing and benchmarking the tool.
+# The RomFS holds the given number of files spread over directories of 100, with valid IVFC hashes.
+import hashlib
+import struct
+import sys
+
+
+BLOCK_LOG = 12
+BLOCK_SIZE = 1 << BLOCK_LOG
+MEDIA_UNIT = 0x200
+NONE = 0xFFFFFFFF
+
+def align(value, alignment):
+    return (value + alignment - 1) // alignment * alignment
+
+def sha256(data):
+    return hashlib.sha256(data).digest()
+
+def path_hash(parent, name):
+    value = parent ^ 123456789
+    for c in name.encode("utf-16-le")[::2]:
+        value = ((value >> 5) | (value << 27)) & 0xFFFFFFFF
+        value ^= c
+    return value
+
+def bucket_count(count):
+    if count < 3:
+        return 3
+    if count < 19:
+        return count | 1
+
+    while any(count % p == 0 for p in (2, 3, 5, 7, 11, 13, 17)):
+        count += 1
+    return count
+
+def make_tree(file_count, file_size):
+    tree = {}
+    for i in range(file_count):
+        tree.setdefault("dir{:05d}".format(i // 100), {})["file{:07d}.bin".format(i)] = bytes([i & 0xFF]) * file_size
+    return tree
+
+def build_level3(tree):
+    # Directories in breadth first order, each directory's files together
+    dirs = [{"name": "", "parent": 0, "node": tree, "children": [], "files": []}]
+    files = []
+    queue = [0]
+    while queue:
+        index = queue.pop(0)
+        for name, value in sorted(dirs[index]["node"].items()):
+            if isinstance(value, dict):
+                dirs[index]["children"].append(len(dirs))
+                queue.append(len(dirs))
+                dirs.append({"name": name, "parent": index, "node": value, "children": [], "files": []})
+            else:
+                dirs[index]["files"].append(len(files))
+                files.append({"name": name, "parent": index, "data": value})
+
+    offset = 0
+    for entry in dirs:
+        entry["offset"] = offset
+        offset += 0x18 + align(len(entry["name"]) * 2, 4)
+    dir_meta_length = offset
+
+    offset = 0
+    data = bytearray()
+    for entry in files:
+        entry["offset"] = offset
+        offset += 0x20 + align(len(entry["name"]) * 2, 4)
+        data += bytes(align(len(data), 16) - len(data))
+        entry["data_offset"] = len(data)
+        data += entry["data"]
+    file_meta_length = offset
+
+    dir_buckets = [NONE] * bucket_count(len(dirs))
+    file_buckets = [NONE] * bucket_count(len(files))
+    for entries, buckets in ((dirs, dir_buckets), (files, file_buckets)):
+        for entry in entries:
+            bucket = path_hash(dirs[entry["parent"]]["offset"], entry["name"]) % len(buckets)
+            entry["next"] = buckets[bucket]
+            buckets[bucket] = entry["offset"]
+
+    def sibling(entries, siblings, index):
+        position = siblings.index(index)
+        return entries[siblings[position + 1]]["offset"] if position + 1 < len(siblings) else NONE
+
+    def name_bytes(name):
+        raw = name.encode("utf-16-le")
+        return raw + bytes(align(len(raw), 4) - len(raw))
+
+    dir_meta = bytearray()
+    for index, entry in enumerate(dirs):
+        parent = dirs[entry["parent"]]
+        next_sibling = sibling(dirs, parent["children"], index) if index > 0 else NONE
+        child = dirs[entry["children"][0]]["offset"] if entry["children"] else NONE
+        first_file = files[entry["files"][0]]["offset"] if entry["files"] else NONE
+        dir_meta += struct.pack("<6I", parent["offset"], next_sibling, child, first_file, entry["next"], len(entry["name"]) * 2)
+        dir_meta += name_bytes(entry["name"])
+
+    file_meta = bytearray()
+    for index, entry in enumerate(files):
+        parent = dirs[entry["parent"]]
+        next_sibling = sibling(files, parent["files"], index)
+        file_meta += struct.pack("<IIQQII", parent["offset"], next_sibling, entry["data_offset"], len(entry["data"]), entry["next"], len(entry["name"]) * 2)
+        file_meta += name_bytes(entry["name"])
+
+    dir_hash_offset = 0x28
+    dir_meta_offset = dir_hash_offset + len(dir_buckets) * 4
+    file_hash_offset = dir_meta_offset + dir_meta_length
+    file_meta_offset = file_hash_offset + len(file_buckets) * 4
+    file_data_offset = align(file_meta_offset + file_meta_length, 16)
+
+    level3 = bytearray(struct.pack("<10I", 0x28, dir_hash_offset, len(dir_buckets) * 4, dir_meta_offset, dir_meta_length,
+        file_hash_offset, len(file_buckets) * 4, file_meta_offset, file_meta_length, file_data_offset))
+    level3 += struct.pack("<{}I".format(len(dir_buckets)), *dir_buckets) + dir_meta
+    level3 += struct.pack("<{}I".format(len(file_buckets)), *file_buckets) + file_meta
+    level3 += bytes(file_data_offset - len(level3))
+    return bytes(level3 + data)
+
+def hash_level(data):
+    return b"".join(sha256(data[i:i + BLOCK_SIZE].ljust(BLOCK_SIZE, b"\0")) for i in range(0, len(data), BLOCK_SIZE))
+
+def build_romfs(tree):
+    level3 = build_level3(tree)
+    level2 = hash_level(level3)
+    level1 = hash_level(level2)
+    master_hash = hash_level(level1)
+
+    # Logical offsets, the levels are stored as level 3, level 1, level 2
+    level2_offset = align(len(level1), BLOCK_SIZE)
+    level3_offset = align(level2_offset + len(level2), BLOCK_SIZE)
+    header = b"IVFC" + struct.pack("<II", 0x10000, len(master_hash))
+    header += struct.pack("<QQII", 0, len(level1), BLOCK_LOG, 0)
+    header += struct.pack("<QQII", level2_offset, len(level2), BLOCK_LOG, 0)
+    header += struct.pack("<QQII", level3_offset, len(level3), BLOCK_LOG, 0)
+    header = header.ljust(0x60, b"\0") + master_hash
+
+    romfs = bytearray(header)
+    for level in (level3, level1, level2):
+        romfs += bytes(align(len(romfs), BLOCK_SIZE) - len(romfs)) + level
+    romfs += bytes(align(len(romfs), MEDIA_UNIT) - len(romfs))
+    return bytes(romfs), align(len(header), MEDIA_UNIT) // MEDIA_UNIT
+
+def build_exefs(files):
+    header = bytearray(0x200)
+    data = bytearray()
+    for i, (name, content) in enumerate(files):
+        struct.pack_into("<8sII", header, i * 16, name.encode(), len(data), len(content))
+        header[0xC0 + (9 - i) * 32:0xC0 + (10 - i) * 32] = sha256(content)
+        data += content
+        data += bytes(align(len(data), MEDIA_UNIT) - len(data))
+    return bytes(header + data)
+
+def build_ncch(tree, code, compressed, program_id):
+    # System control info, the only field read is the compressed .code flag
+    exheader = bytearray(0x800)
+    exheader[0:8] = b"TESTAPP\0"
+    exheader[0xD] = 1 if compressed else 0
+
+    exefs = build_exefs([(".code", code), ("banner", b"B" * 0x100), ("icon", b"I" * 0x36C0)])
+    romfs, romfs_hash_size = build_romfs(tree)
+
+    exefs_offset = 0xA00
+    romfs_offset = align(exefs_offset + len(exefs), 0x1000)
+    size = romfs_offset + len(romfs)
+
+    header = bytearray(0x200)
+    header[0x100:0x104] = b"NCCH"
+    struct.pack_into("<IQHH", header, 0x104, size // MEDIA_UNIT, program_id, 0x3130, 2)
+    struct.pack_into("<Q", header, 0x118, program_id)
+    header[0x150:0x160] = b"CTR-P-TEST".ljust(16, b"\0")
+    header[0x160:0x180] = sha256(exheader[:0x400])
+    struct.pack_into("<I", header, 0x180, 0x400)
+    header[0x18F] = 4 # NoCrypto
+    struct.pack_into("<4I", header, 0x1A0, exefs_offset // MEDIA_UNIT, len(exefs) // MEDIA_UNIT, 1, 0)
+    struct.pack_into("<3I", header, 0x1B0, romfs_offset // MEDIA_UNIT, len(romfs) // MEDIA_UNIT, romfs_hash_size)
+    header[0x1C0:0x1E0] = sha256(exefs[:0x200])
+    header[0x1E0:0x200] = sha256(romfs[:romfs_hash_size * MEDIA_UNIT])
+
+    image = bytearray(size)
+    image[0:0x200] = header
+    image[0x200:0xA00] = exheader
+    image[exefs_offset:exefs_offset + len(exefs)] = exefs
+    image[romfs_offset:] = romfs
+    return bytes(image)
+
+def build_ncsd(partition):
+    header = bytearray(0x4000)
+    header[0x100:0x104] = b"NCSD"
+    struct.pack_into("<I", header, 0x104, (len(header) + len(partition)) // MEDIA_UNIT)
+    struct.pack_into("<II", header, 0x120, len(header) // MEDIA_UNIT, len(partition) // MEDIA_UNIT)
+    struct.pack_into("<Q", header, 0x190, 0x0004000000123400)
+    return bytes(header) + partition
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: make_test_image.py <output.cxi|output.3ds> <file count> [file size] [.code file] [--compressed]")
+        exit(0)
+
+    file_count = int(sys.argv[2])
+    file_size = int(sys.argv[3]) if len(sys.argv) > 3 else 16
+    code = bytes(range(256)) * 16
+    if len(sys.argv) > 4:
+        with open(sys.argv[4], "rb") as code_file:
+            code = code_file.read()
+
+    ncch = build_ncch(make_tree(file_count, file_size), code, "--compressed" in sys.argv[5:], 0x0004000000123400)
+    with open(sys.argv[1], "wb") as output_file:
+        output_file.write(ncch if sys.argv[1].endswith(".cxi") else build_ncsd(ncch))
+
+
+if __name__ == "__main__":
+    main()
\ No newline at end of file